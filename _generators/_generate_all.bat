@@ -35,6 +35,7 @@
 umba-enum-gen %GEN_OPTS% %HEX2% %TPL_OVERRIDE% %SNIPPETOPTIONS_GEN_FLAGS%              ^
     %UINT32% %HEX4% -E=Endianness                -F=@Endianness.txt                    ^
     %UINT32% %HEX4% -E=MemoryAccessResultCode    -F=@MemoryAccessResultCode.txt        ^
+    %UINT32% %HEX4% -E=MemoryStorageType         -F=@MemoryStorageType.txt             ^
     %FLAGS%                                                                            ^
     %UINT32% %HEX4% -E=MemoryOptionFlags         -F=@MemoryOptionFlags.txt             ^
     %UINT32% %HEX4% -E=MemoryAccessRights        -F=@MemoryAccessRights.txt            ^
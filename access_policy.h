@@ -0,0 +1,127 @@
+/*! \file
+    \brief Политики проверки прав доступа и значений по умолчанию для BasicMemory
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    BasicMemory вызывает проверку прав доступа на каждое обращение и запрос значения
+    по умолчанию на каждый промах. Политика определяет, как это делается:
+
+    AccessPolicy::checkAccessRights(mem, addr, size, requestedMode)
+    DefaultValuePolicy::getDefaultValue(mem, addr, size, memoryOptionFlags)
+
+      VirtualAccessPolicy/VirtualDefaultValuePolicy       - через виртуальные методы
+          BasicMemory::checkAccessRights/getDefaultValue, которые можно переопределить
+          в наследнике (как было исторически, Memory);
+      RegionTableAccessPolicy/RegionTableDefaultValuePolicy - напрямую через таблицу
+          регионов (addAccessRegion), без виртуального вызова, встраивается;
+      NoAccessCheckPolicy                                  - проверки нет вообще, после
+          встраивания она исчезает из кода доступа;
+      FlagsDefaultValuePolicy                              - 0x00 или 0xFF по MemoryOptionFlags::defaultFf.
+*/
+
+//----------------------------------------------------------------------------
+#include "bits.h"
+#include "enums.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/access_policy.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+struct VirtualAccessPolicy
+{
+    template<typename MemoryType>
+    static MemoryAccessResultCode checkAccessRights(const MemoryType &mem, uint64_t addr, uint64_t size, MemoryAccessRights requestedMode)
+    {
+        return mem.checkAccessRights(addr, size, requestedMode);
+    }
+
+}; // struct VirtualAccessPolicy
+
+//----------------------------------------------------------------------------
+struct RegionTableAccessPolicy
+{
+    template<typename MemoryType>
+    static MemoryAccessResultCode checkAccessRights(const MemoryType &mem, uint64_t addr, uint64_t size, MemoryAccessRights requestedMode)
+    {
+        return mem.getAccessRegionTable().checkAccessRights(addr, size, requestedMode);
+    }
+
+}; // struct RegionTableAccessPolicy
+
+//----------------------------------------------------------------------------
+struct NoAccessCheckPolicy
+{
+    template<typename MemoryType>
+    static constexpr MemoryAccessResultCode checkAccessRights(const MemoryType &, uint64_t, uint64_t, MemoryAccessRights)
+    {
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+}; // struct NoAccessCheckPolicy
+
+//----------------------------------------------------------------------------
+struct VirtualDefaultValuePolicy
+{
+    template<typename MemoryType>
+    static uint64_t getDefaultValue(const MemoryType &mem, uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags)
+    {
+        return mem.getDefaultValue(addr, size, memoryOptionFlags);
+    }
+
+}; // struct VirtualDefaultValuePolicy
+
+//----------------------------------------------------------------------------
+struct FlagsDefaultValuePolicy
+{
+    template<typename MemoryType>
+    static uint64_t getDefaultValue(const MemoryType &, uint64_t, uint64_t size, MemoryOptionFlags memoryOptionFlags)
+    {
+        if ((memoryOptionFlags&MemoryOptionFlags::defaultFf)!=0)
+            return bits::makeByteSizeMask(int(size));
+        return 0;
+    }
+
+}; // struct FlagsDefaultValuePolicy
+
+//----------------------------------------------------------------------------
+struct RegionTableDefaultValuePolicy
+{
+    template<typename MemoryType>
+    static uint64_t getDefaultValue(const MemoryType &mem, uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags)
+    {
+        const auto &regionTable = mem.getAccessRegionTable();
+        if (regionTable.empty())
+            return FlagsDefaultValuePolicy::getDefaultValue(mem, addr, size, memoryOptionFlags);
+
+        byte_t unmappedByte = (memoryOptionFlags&MemoryOptionFlags::defaultFf)!=0 ? byte_t(0xFFu) : byte_t(0);
+        return regionTable.getDefaultValue(addr, size, unmappedByte);
+    }
+
+}; // struct RegionTableDefaultValuePolicy
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/access_policy.h"
+
@@ -0,0 +1,356 @@
+/*! \file
+    \brief Итераторы памяти по адресу конкретной модели (LinearAddress/SegmentedAddress), хранимому по значению
+ */
+
+/*
+    VirtualAddressMemoryIterator хранит адрес в InlineVirtualAddress - копии итератора уже не выделяют память,
+    но каждый шаг, сравнение и получение линейного адреса - виртуальный вызов, который компилятор не встроит.
+    Если модель адреса известна при компиляции, используем AddressMemoryIterator<IntType, AddressModel> -
+    методы модели вызываются с квалификацией (AddressModel::inc), без виртуальной диспетчеризации, и встраиваются
+    в цикл обхода. VirtualAddressMemoryIterator остаётся для моделей, выбираемых во время выполнения.
+
+*/
+
+#pragma once
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "exceptions.h"
+#include "fixed_size_types.h"
+#include "linear_address.h"
+#include "segmented_address.h"
+#include "virtual_address.h"
+#include "marty_mem.h"
+
+//----------------------------------------------------------------------------
+#include <iterator>
+#include <string>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/address_memory_iterator.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<typename IntType, typename AddressModel, typename MemoryType=Memory>
+struct AddressMemoryIterator
+{
+
+    MemoryType             *pMemory = 0;
+    MemoryOptionFlags       memoryOptionFlags = MemoryOptionFlags::none;
+    AddressModel            address;
+    bool                    lastModificationWrapSign = false; // Признак переполнения при последней операции изменения итератора
+
+
+    struct AccessProxy
+    {
+        MemoryType         *pMemory = 0;
+        uint64_t            address = 0;
+        MemoryOptionFlags   memoryOptionFlags = 0;
+
+        AccessProxy() {}
+
+        explicit AccessProxy(MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        {
+            MARTY_MEM_ASSERT(pMemory);
+        }
+
+        AccessProxy& operator=(IntType b)
+        {
+            auto rc = pMemory->write(b, address, memoryOptionFlags);
+            throwMemoryAccessError(rc);
+            return *this;
+        }
+
+        operator IntType() const
+        {
+            IntType resVal = 0;
+            auto rc = pMemory->read(&resVal, address, memoryOptionFlags);
+            throwMemoryAccessError(rc);
+            return resVal;
+        }
+
+    }; // struct AccessProxy
+
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type        = IntType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = AccessProxy;
+
+
+    AddressMemoryIterator() {}
+
+    explicit AddressMemoryIterator(MemoryType *pm, const AddressModel &a, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), address(a)
+    {
+        // MARTY_MEM_ASSERT(pMemory); // Можно создавать итераторы с нулевым указателем на память, но нельзя по ним обращаться к памяти
+
+        mof &= MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss | MemoryOptionFlags::errorOnWrapedAddressAccess; // Пропускаем извне только эти флаги
+        if (pMemory)
+            memoryOptionFlags  = pMemory->getMemoryTraits().memoryOptionFlags;
+        // В опциях memory сбрасываем эти флаги, не используем дефолтные установки
+        memoryOptionFlags &= ~(MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss | MemoryOptionFlags::errorOnWrapedAddressAccess);
+        memoryOptionFlags |= mof;
+
+        address.AddressModel::setIncrement(sizeof(IntType));
+    }
+
+    template<typename OtherType>
+    explicit AddressMemoryIterator(const AddressMemoryIterator<OtherType, AddressModel, MemoryType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags), address(other.address)
+    {
+        address.AddressModel::setIncrement(sizeof(IntType));
+    }
+
+    // Остальные ctor/op= компилятор сам сгенерит - копия итератора это просто копия значения
+
+    AddressInfo getAddressInfo() const
+    {
+        return address.AddressModel::getAddressInfo();
+    }
+
+    operator std::uint64_t() const    { return address.AddressModel::getLinearAddress(); }
+    operator std::string  () const    { return address.AddressModel::toString(); }
+
+
+    bool getThrowOnWrapOption() const { return (memoryOptionFlags & MemoryOptionFlags::errorOnAddressWrap)!=0; }
+    bool getThrowOnWrapAccessOption() const { return (memoryOptionFlags & MemoryOptionFlags::errorOnWrapedAddressAccess)!=0; }
+    void throwAddressWrap    () const
+    {
+        throwMemoryAccessError( MemoryAccessResultCode::addressWrap
+                              , std::string() // use default message
+                              , "address: " + std::string(*this) + ", linear: " + std::to_string(std::uint64_t(*this))
+                              );
+    }
+
+    void inc     ()             { lastModificationWrapSign=address.AddressModel::inc     ( ); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void dec     ()             { lastModificationWrapSign=address.AddressModel::dec     ( ); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void add     (ptrdiff_t d)  { lastModificationWrapSign=address.AddressModel::add     (d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void subtract(ptrdiff_t d)  { lastModificationWrapSign=address.AddressModel::subtract(d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+
+    AddressMemoryIterator& operator++()    /* pre  */  { inc(); return *this; }
+    AddressMemoryIterator  operator++(int) /* post */  { auto cp = *this; inc(); return cp; }
+    AddressMemoryIterator& operator--()    /* pre  */  { dec(); return *this; }
+    AddressMemoryIterator  operator--(int) /* post */  { auto cp = *this; dec(); return cp; }
+    AddressMemoryIterator& operator+=(ptrdiff_t d)     { add(d); return *this; }
+    AddressMemoryIterator& operator-=(ptrdiff_t d)     { subtract(d); return *this; }
+
+    AccessProxy operator*() const
+    {
+        if (lastModificationWrapSign && getThrowOnWrapAccessOption())
+            throwAddressWrap();
+        return AccessProxy(pMemory, address.AddressModel::getLinearAddress(), memoryOptionFlags);
+    }
+
+}; // struct AddressMemoryIterator
+
+
+template<typename IntType, typename AddressModel, typename MemoryType> AddressMemoryIterator<IntType, AddressModel, MemoryType> operator+(AddressMemoryIterator<IntType, AddressModel, MemoryType> it, ptrdiff_t d) { it += d; return it; }
+template<typename IntType, typename AddressModel, typename MemoryType> AddressMemoryIterator<IntType, AddressModel, MemoryType> operator+(ptrdiff_t d, AddressMemoryIterator<IntType, AddressModel, MemoryType> it) { it += d; return it; }
+template<typename IntType, typename AddressModel, typename MemoryType> AddressMemoryIterator<IntType, AddressModel, MemoryType> operator-(AddressMemoryIterator<IntType, AddressModel, MemoryType> it, ptrdiff_t d) { it -= d; return it; }
+
+template<typename IntType, typename AddressModel, typename MemoryType> ptrdiff_t operator-(const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return it2.address.distanceTo(it1.address);
+}
+
+template<typename IntType, typename AddressModel, typename MemoryType> bool operator==(const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return it1.address.equalTo(it2.address);
+}
+
+template<typename IntType, typename AddressModel, typename MemoryType> bool operator!=(const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const AddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return !it1.address.equalTo(it2.address);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<typename IntType, typename AddressModel, typename MemoryType=Memory>
+struct ConstAddressMemoryIterator
+{
+
+    const MemoryType       *pMemory = 0;
+    MemoryOptionFlags       memoryOptionFlags = MemoryOptionFlags::none;
+    AddressModel            address;
+    bool                    lastModificationWrapSign = false; // Признак переполнения при последней операции изменения итератора
+
+
+    struct AccessProxy
+    {
+        const MemoryType   *pMemory = 0;
+        uint64_t            address = 0;
+        MemoryOptionFlags   memoryOptionFlags = 0;
+
+        AccessProxy() {}
+
+        explicit AccessProxy(const MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        {
+            MARTY_MEM_ASSERT(pMemory);
+        }
+
+        operator IntType() const
+        {
+            IntType resVal = 0;
+            auto rc = pMemory->read(&resVal, address, memoryOptionFlags);
+            throwMemoryAccessError(rc);
+            return resVal;
+        }
+
+    }; // struct AccessProxy
+
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type        = IntType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = AccessProxy;
+
+
+    ConstAddressMemoryIterator() {}
+
+    explicit ConstAddressMemoryIterator(const MemoryType *pm, const AddressModel &a, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), address(a)
+    {
+        //MARTY_MEM_ASSERT(pMemory);
+
+        mof &= MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss | MemoryOptionFlags::errorOnWrapedAddressAccess; // Пропускаем извне только эти флаги
+        if (pMemory)
+            memoryOptionFlags  = pMemory->getMemoryTraits().memoryOptionFlags;
+        // В опциях memory сбрасываем эти флаги, не используем дефолтные установки
+        memoryOptionFlags &= ~(MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss | MemoryOptionFlags::errorOnWrapedAddressAccess);
+        memoryOptionFlags |= mof;
+
+        address.AddressModel::setIncrement(sizeof(IntType));
+
+        if (!address.AddressModel::checkAddressInValidSizeRange() && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
+            throwMemoryAccessError(MemoryAccessResultCode::addressWrap);
+    }
+
+    template<typename OtherType>
+    explicit ConstAddressMemoryIterator(const ConstAddressMemoryIterator<OtherType, AddressModel, MemoryType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags), address(other.address)
+    {
+        address.AddressModel::setIncrement(sizeof(IntType));
+    }
+
+    ConstAddressMemoryIterator(const AddressMemoryIterator<IntType, AddressModel, MemoryType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags), address(other.address), lastModificationWrapSign(other.lastModificationWrapSign)
+    {
+    }
+
+    // Остальные ctor/op= компилятор сам сгенерит - копия итератора это просто копия значения
+
+    AddressInfo getAddressInfo() const
+    {
+        return address.AddressModel::getAddressInfo();
+    }
+
+    operator std::uint64_t() const    { return address.AddressModel::getLinearAddress(); }
+    operator std::string  () const    { return address.AddressModel::toString(); }
+
+    bool getThrowOnWrapOption() const { return (memoryOptionFlags & MemoryOptionFlags::errorOnAddressWrap)!=0; }
+    bool getThrowOnWrapAccessOption() const { return (memoryOptionFlags & MemoryOptionFlags::errorOnWrapedAddressAccess)!=0; }
+    void throwAddressWrap    () const
+    {
+        throwMemoryAccessError( MemoryAccessResultCode::addressWrap
+                              , std::string() // use default message
+                              , "address: " + std::string(*this) + ", linear: " + std::to_string(std::uint64_t(*this))
+                              );
+    }
+
+    void inc     ()             { lastModificationWrapSign=address.AddressModel::inc     ( ); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void dec     ()             { lastModificationWrapSign=address.AddressModel::dec     ( ); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void add     (ptrdiff_t d)  { lastModificationWrapSign=address.AddressModel::add     (d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+    void subtract(ptrdiff_t d)  { lastModificationWrapSign=address.AddressModel::subtract(d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
+
+    ConstAddressMemoryIterator& operator++()    /* pre  */  { inc(); return *this; }
+    ConstAddressMemoryIterator  operator++(int) /* post */  { auto cp = *this; inc(); return cp; }
+    ConstAddressMemoryIterator& operator--()    /* pre  */  { dec(); return *this; }
+    ConstAddressMemoryIterator  operator--(int) /* post */  { auto cp = *this; dec(); return cp; }
+    ConstAddressMemoryIterator& operator+=(ptrdiff_t d)     { add(d); return *this; }
+    ConstAddressMemoryIterator& operator-=(ptrdiff_t d)     { subtract(d); return *this; }
+
+    AccessProxy operator*() const
+    {
+        if (lastModificationWrapSign && getThrowOnWrapAccessOption())
+            throwAddressWrap();
+        return AccessProxy(pMemory, address.AddressModel::getLinearAddress(), memoryOptionFlags);
+    }
+
+}; // struct ConstAddressMemoryIterator
+
+
+template<typename IntType, typename AddressModel, typename MemoryType> ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> operator+(ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> it, ptrdiff_t d) { it += d; return it; }
+template<typename IntType, typename AddressModel, typename MemoryType> ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> operator+(ptrdiff_t d, ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> it) { it += d; return it; }
+template<typename IntType, typename AddressModel, typename MemoryType> ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> operator-(ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> it, ptrdiff_t d) { it -= d; return it; }
+
+template<typename IntType, typename AddressModel, typename MemoryType> ptrdiff_t operator-(const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return it2.address.distanceTo(it1.address);
+}
+
+template<typename IntType, typename AddressModel, typename MemoryType> bool operator==(const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return it1.address.equalTo(it2.address);
+}
+
+template<typename IntType, typename AddressModel, typename MemoryType> bool operator!=(const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it1, const ConstAddressMemoryIterator<IntType, AddressModel, MemoryType> &it2)
+{
+    return !it1.address.equalTo(it2.address);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<typename IntType, typename MemoryType=Memory> using LinearAddressMemoryIterator         = AddressMemoryIterator<IntType, LinearAddress, MemoryType>;
+template<typename IntType, typename MemoryType=Memory> using ConstLinearAddressMemoryIterator    = ConstAddressMemoryIterator<IntType, LinearAddress, MemoryType>;
+template<typename IntType, typename MemoryType=Memory> using SegmentedAddressMemoryIterator      = AddressMemoryIterator<IntType, SegmentedAddress, MemoryType>;
+template<typename IntType, typename MemoryType=Memory> using ConstSegmentedAddressMemoryIterator = ConstAddressMemoryIterator<IntType, SegmentedAddress, MemoryType>;
+
+template<typename IntType, typename MemoryType>
+LinearAddressMemoryIterator<IntType, MemoryType> makeLinearAddressMemoryIterator(MemoryType *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
+{
+    return LinearAddressMemoryIterator<IntType, MemoryType>(pMemory, LinearAddress(addr, uint64_t(sizeof(IntType)), traits), memoryOptionFlags);
+}
+
+template<typename IntType, typename MemoryType>
+ConstLinearAddressMemoryIterator<IntType, MemoryType> makeLinearConstAddressMemoryIterator(const MemoryType *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
+{
+    return ConstLinearAddressMemoryIterator<IntType, MemoryType>(pMemory, LinearAddress(addr, uint64_t(sizeof(IntType)), traits), memoryOptionFlags);
+}
+
+template<typename IntType, typename MemoryType>
+SegmentedAddressMemoryIterator<IntType, MemoryType> makeSegmentedAddressMemoryIterator(MemoryType *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
+{
+    return SegmentedAddressMemoryIterator<IntType, MemoryType>(pMemory, SegmentedAddress(seg, offs, uint64_t(sizeof(IntType)), traits), memoryOptionFlags);
+}
+
+template<typename IntType, typename MemoryType>
+ConstSegmentedAddressMemoryIterator<IntType, MemoryType> makeSegmentedConstAddressMemoryIterator(const MemoryType *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
+{
+    return ConstSegmentedAddressMemoryIterator<IntType, MemoryType>(pMemory, SegmentedAddress(seg, offs, uint64_t(sizeof(IntType)), traits), memoryOptionFlags);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/address_memory_iterator.h"
+
@@ -17,6 +17,11 @@
 #include <string>
 #include <unordered_map>
 
+#if defined(_MSC_VER)
+    #include <stdlib.h>
+    #include <intrin.h>
+#endif
+
 //----------------------------------------------------------------------------
 
 
@@ -35,13 +40,30 @@ namespace bits{
 //----------------------------------------------------------------------------
 // How do I convert between big-endian and little-endian values in C++? - https://stackoverflow.com/questions/105252/how-do-i-convert-between-big-endian-and-little-endian-values-in-c/105371#105371
 // GCC intrinsics - https://gcc.gnu.org/onlinedocs/gcc/Other-Builtins.html
-// TODO: use intrinsics if available
+// MSVC intrinsics - https://learn.microsoft.com/en-us/cpp/c-runtime-library/reference/byteswap-uint64-byteswap-ulong-byteswap-ushort
 
 inline uint8_t  swapBytes(uint8_t u)   { return u; }
+
+#if defined(__GNUC__) || defined(__clang__)
+
+inline uint16_t swapBytes(uint16_t u)  { return __builtin_bswap16(u); }
+inline uint32_t swapBytes(uint32_t u)  { return __builtin_bswap32(u); }
+inline uint64_t swapBytes(uint64_t u)  { return __builtin_bswap64(u); }
+
+#elif defined(_MSC_VER)
+
+inline uint16_t swapBytes(uint16_t u)  { return _byteswap_ushort(u); }
+inline uint32_t swapBytes(uint32_t u)  { return _byteswap_ulong(u); }
+inline uint64_t swapBytes(uint64_t u)  { return _byteswap_uint64(u); }
+
+#else
+
 inline uint16_t swapBytes(uint16_t u)  { return uint16_t((u>>8) | (u<<8)); }
 inline uint32_t swapBytes(uint32_t u)  { return uint32_t(swapBytes(uint16_t(u>>16))) | uint32_t(uint32_t(swapBytes(uint16_t(u))) << 16); }
 inline uint64_t swapBytes(uint64_t u)  { return uint64_t(swapBytes(uint32_t(u>>32))) | uint64_t(uint64_t(swapBytes(uint32_t(u))) << 32); }
 
+#endif
+
 inline int8_t   swapBytes(int8_t u)    { return int8_t (swapBytes(uint8_t(u))) ; }
 inline int16_t  swapBytes(int16_t u)   { return int16_t(swapBytes(uint16_t(u))); }
 inline int32_t  swapBytes(int32_t u)   { return int32_t(swapBytes(uint32_t(u))); }
@@ -107,6 +129,30 @@ constexpr inline int getMsbPower(int16_t v)  { return getMsbPower(uint16_t(v));
 constexpr inline int getMsbPower(int32_t v)  { return getMsbPower(uint32_t(v)); }
 constexpr inline int getMsbPower(int64_t v)  { return getMsbPower(uint64_t(v)); }
 
+//----------------------------------------------------------------------------
+//! Число младших нулевых бит; для v==0 - 64
+inline int countTrailingZeros(uint64_t v)
+{
+    if (!v)
+        return 64;
+
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx = 0;
+    _BitScanForward64(&idx, v);
+    return int(idx);
+#else
+    int n = 0;
+    while(!(v&1u))
+    {
+        v >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
 //----------------------------------------------------------------------------
 inline
 uint64_t makeByteSizeMask(int n)
@@ -0,0 +1,228 @@
+/*! \file
+    \brief Битовая карта изменённых (dirty) страниц
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Один бит на страницу, биты собраны в 64-битные слова. Адресное пространство
+    большое и разреженное, поэтому слова хранятся в unordered_map по номеру слова
+    (номер страницы>>6). Записи обычно локальны, поэтому последнее использованное
+    слово кешируется - повторная запись в ту же область стоит одного сравнения
+    и одного OR (узлы unordered_map не перемещаются, указатель на слово стабилен).
+
+    Отслеживание включается явно (setEnabled), выключенное стоит одной проверки флага.
+    collect() выдаёт изменённые диапазоны (соседние страницы склеиваются) в порядке
+    возрастания адресов.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "bits.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/dirty_bitmap.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+struct DirtyMemoryRange
+{
+    uint64_t    addr = 0;
+    uint64_t    size = 0;
+
+}; // struct DirtyMemoryRange
+
+//----------------------------------------------------------------------------
+template<int PageBits>
+class DirtyPageBitmap
+{
+
+public:
+
+    static constexpr const uint64_t    pageSize = uint64_t(1)<<PageBits;
+    static constexpr const uint64_t    pageMask = pageSize-1u;
+
+
+protected:
+
+    static constexpr const uint64_t    noKey    = ~uint64_t(0); // Номер слова не бывает больше 2^(64-PageBits-6)
+
+    std::unordered_map<uint64_t, uint64_t>    m_words;
+    bool                                      m_enabled   = false;
+    uint64_t                                  m_lastKey   = noKey;
+    uint64_t                                 *m_pLastWord = 0;
+
+
+    void markPage(uint64_t pageIdx)
+    {
+        uint64_t key = pageIdx>>6;
+        if (key!=m_lastKey)
+        {
+            m_pLastWord = &m_words[key];
+            m_lastKey   = key;
+        }
+
+        *m_pLastWord |= uint64_t(1)<<(pageIdx&63u);
+    }
+
+    void resetCache()
+    {
+        m_lastKey   = noKey;
+        m_pLastWord = 0;
+    }
+
+
+public:
+
+    DirtyPageBitmap() {}
+
+    // Кешированный указатель указывает в чужой map - при копировании сбрасываем
+    DirtyPageBitmap(const DirtyPageBitmap &other) : m_words(other.m_words), m_enabled(other.m_enabled) {}
+
+    DirtyPageBitmap& operator=(const DirtyPageBitmap &other)
+    {
+        if (&other!=this)
+        {
+            m_words   = other.m_words;
+            m_enabled = other.m_enabled;
+            resetCache();
+        }
+        return *this;
+    }
+
+    // При перемещении узлы map переходят к новому владельцу вместе с указателем
+    DirtyPageBitmap(DirtyPageBitmap &&other)
+    : m_words(std::move(other.m_words)), m_enabled(other.m_enabled), m_lastKey(other.m_lastKey), m_pLastWord(other.m_pLastWord)
+    {
+        other.m_words.clear();
+        other.resetCache();
+    }
+
+    DirtyPageBitmap& operator=(DirtyPageBitmap &&other)
+    {
+        if (&other!=this)
+        {
+            m_words     = std::move(other.m_words);
+            m_enabled   = other.m_enabled;
+            m_lastKey   = other.m_lastKey;
+            m_pLastWord = other.m_pLastWord;
+            other.m_words.clear();
+            other.resetCache();
+        }
+        return *this;
+    }
+
+    bool isEnabled() const { return m_enabled; }
+
+    //! При выключении накопленные отметки сохраняются до clear()
+    void setEnabled(bool bEnable) { m_enabled = bEnable; }
+
+    bool empty() const
+    {
+        for(const auto &kv : m_words)
+        {
+            if (kv.second)
+                return false;
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        m_words.clear();
+        resetCache();
+    }
+
+    //! Отмечает страницы, которые задевает [addr, addr+size)
+    void markDirty(uint64_t addr, uint64_t size)
+    {
+        if (!m_enabled || !size)
+            return;
+
+        uint64_t firstPage = addr>>PageBits;
+        uint64_t lastPage  = (addr+(size-1u))>>PageBits;
+        for(uint64_t pageIdx=firstPage; ; ++pageIdx)
+        {
+            markPage(pageIdx);
+            if (pageIdx==lastPage)
+                break;
+        }
+    }
+
+    bool isDirty(uint64_t addr) const
+    {
+        uint64_t pageIdx = addr>>PageBits;
+        auto it = m_words.find(pageIdx>>6);
+        return it!=m_words.end() && (it->second&(uint64_t(1)<<(pageIdx&63u)))!=0;
+    }
+
+    //! Изменённые диапазоны по возрастанию адресов, соседние страницы склеены
+    std::vector<DirtyMemoryRange> collect() const
+    {
+        std::vector<uint64_t> keys;
+        keys.reserve(m_words.size());
+        for(const auto &kv : m_words)
+        {
+            if (kv.second)
+                keys.push_back(kv.first);
+        }
+
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<DirtyMemoryRange> res;
+        for(auto key : keys)
+        {
+            uint64_t word = m_words.find(key)->second;
+            while(word)
+            {
+                // Очередная серия единичных бит
+                unsigned first = unsigned(bits::countTrailingZeros(word));
+                uint64_t rest  = word>>first;
+                unsigned len   = rest==~uint64_t(0) ? 64u-first : unsigned(bits::countTrailingZeros(~rest));
+
+                uint64_t addr = ((key<<6)+first)<<PageBits;
+                uint64_t size = uint64_t(len)<<PageBits;
+
+                if (!res.empty() && res.back().addr+res.back().size==addr)
+                    res.back().size += size;
+                else
+                    res.emplace_back(DirtyMemoryRange{addr, size});
+
+                word = (first+len)>=64u ? 0u : word & (~uint64_t(0)<<(first+len));
+            }
+        }
+
+        return res;
+    }
+
+}; // class DirtyPageBitmap
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/dirty_bitmap.h"
+
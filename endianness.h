@@ -0,0 +1,282 @@
+/*! \file
+    \brief Политики порядка байт для BasicMemory
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Значение из памяти собирается так, как будто оно лежит в little-endian
+    (младший байт - по младшему адресу), затем политика переводит его в
+    значение хоста (fromMemory). При записи - наоборот (toMemory).
+
+    Все поддерживаемые порядки байт - перестановки вида j -> j^mask, где j - номер
+    байта в памяти, а j^mask - номер байта значения (от младшего). Маска зависит
+    от порядка и размера значения (см. getEndiannessPermutationMask):
+
+        littleEndian   - 0
+        bigEndian      - size-1
+        leMiddleEndian - size/2             - старшая половина первой, байты в половинах - LE
+        beMiddleEndian - size/2-1           - младшая половина первой, байты в половинах - BE
+        middleEndian   - size-2 (size>=2)   - 16-битные слова от старшего к младшему, байты в словах - LE (PDP-11)
+
+    Для 0x0A0B0C0D (адреса по возрастанию):
+        littleEndian   - 0D 0C 0B 0A
+        bigEndian      - 0A 0B 0C 0D
+        leMiddleEndian - 0B 0A 0D 0C        (64 бита - как double в ARM FPA: старшее слово первым, слова LE)
+        beMiddleEndian - 0C 0D 0A 0B
+        middleEndian   - 0B 0A 0D 0C        (для 64 бит отличается от leMiddleEndian)
+
+    Перестановка реализуется не побайтно, а стадиями обмена соседних байт, 16-битных и 32-битных
+    половин (по битам маски); полная маска - это просто bswap. При порядке байт, известном на этапе
+    компиляции, маска константна и лишние стадии исчезают.
+
+    Для массивов (permuteArrayBytes) перестановка делается через pshufb (SSSE3/AVX2),
+    маска перестановки для 16 байт строится по той же формуле j^mask.
+
+    RuntimeEndianness - порядок байт берётся из MemoryTraits при каждом обращении.
+    StaticEndianness<E> - порядок задан на этапе компиляции, ветвлений нет,
+    для little-endian преобразование исчезает совсем, для big-endian остаётся
+    одна инструкция bswap.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "bits.h"
+#include "enums.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+    #include <immintrin.h>
+#endif
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/endianness.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+namespace details
+{
+
+template<std::size_t Size> struct EndiannessUInt;
+template<> struct EndiannessUInt<1> { using type = uint8_t ; };
+template<> struct EndiannessUInt<2> { using type = uint16_t; };
+template<> struct EndiannessUInt<4> { using type = uint32_t; };
+template<> struct EndiannessUInt<8> { using type = uint64_t; };
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+inline constexpr
+bool isEndiannessSupported(Endianness e)
+{
+    return e==Endianness::littleEndian   || e==Endianness::bigEndian
+        || e==Endianness::leMiddleEndian || e==Endianness::beMiddleEndian
+        || e==Endianness::middleEndian;
+}
+
+//! Маска перестановки: байт памяти j содержит байт значения j^mask
+inline constexpr
+unsigned getEndiannessPermutationMask(Endianness e, std::size_t size)
+{
+    return size<2u                        ? 0u
+         : e==Endianness::bigEndian       ? unsigned(size-1u)
+         : e==Endianness::leMiddleEndian  ? unsigned(size/2u)
+         : e==Endianness::beMiddleEndian  ? unsigned(size/2u-1u)
+         : e==Endianness::middleEndian    ? unsigned(size-2u)
+         : 0u;
+}
+
+//! Перестановка байт значения по маске. Перестановка j -> j^mask обратна сама себе, поэтому годится в обе стороны
+template<typename IntType>
+IntType permuteBytes(IntType v, unsigned mask)
+{
+    // Беззнаковый тип фиксированного размера - чтобы long long и т.п. однозначно попадали в нужный swapBytes
+    using UIntType = typename details::EndiannessUInt<sizeof(IntType)>::type;
+
+    if (sizeof(IntType)==1u || mask==0u)
+        return v;
+
+    UIntType u = UIntType(v);
+
+    if (mask==unsigned(sizeof(IntType)-1u))
+        return IntType(bits::swapBytes(u));
+
+    if (mask&1u)
+        u = UIntType(((u>>8)&UIntType(0x00FF00FF00FF00FFull)) | ((u&UIntType(0x00FF00FF00FF00FFull))<<8));
+
+    if (mask&2u) // sizeof>=4
+        u = UIntType(((uint64_t(u)>>16)&uint64_t(0x0000FFFF0000FFFFull)) | ((uint64_t(u)&uint64_t(0x0000FFFF0000FFFFull))<<16));
+
+    if (mask&4u) // sizeof==8
+        u = UIntType((uint64_t(u)>>32) | (uint64_t(u)<<32));
+
+    return IntType(u);
+}
+
+//----------------------------------------------------------------------------
+//! Маска перестановки для порядка байт хоста - массивы копируются в память хоста как есть
+inline constexpr
+unsigned getHostEndiannessPermutationMask(std::size_t size)
+{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+    return size<2u ? 0u : unsigned(size-1u);
+#else
+    return ((void)size, 0u);
+#endif
+}
+
+//! Переставляет байты в каждом из элементов массива (elemSize - 1/2/4/8). Для перестановки 16/32 байт за раз используется pshufb
+inline
+void permuteArrayBytes(byte_t *pData, std::size_t numElements, std::size_t elemSize, unsigned mask)
+{
+    MARTY_MEM_ASSERT(elemSize==1u || elemSize==2u || elemSize==4u || elemSize==8u);
+
+    if (elemSize==1u || mask==0u)
+        return;
+
+    std::size_t nBytes = numElements*elemSize;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+
+    alignas(16) byte_t shuffle[16];
+    for(std::size_t i=0u; i!=16u; ++i)
+        shuffle[i] = byte_t((i&~(elemSize-1u)) | ((i&(elemSize-1u))^mask));
+
+    __m128i shuffle128 = _mm_load_si128(reinterpret_cast<const __m128i*>(&shuffle[0]));
+
+    #if defined(__AVX2__)
+
+    // vpshufb переставляет байты внутри 128-битных половин, шаблон для обеих половин одинаковый
+    __m256i shuffle256 = _mm256_broadcastsi128_si256(shuffle128);
+    for(; nBytes>=32u; nBytes-=32u, pData+=32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pData), _mm256_shuffle_epi8(v, shuffle256));
+    }
+
+    #endif
+
+    for(; nBytes>=16u; nBytes-=16u, pData+=16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pData), _mm_shuffle_epi8(v, shuffle128));
+    }
+
+#endif
+
+    // Хвост (или всё, если SIMD недоступен) - поэлементно
+    for(; nBytes>=elemSize; nBytes-=elemSize, pData+=elemSize)
+    {
+        switch(elemSize)
+        {
+            case 2 : { uint16_t u; std::memcpy(&u, pData, 2u); u = permuteBytes(u, mask); std::memcpy(pData, &u, 2u); break; }
+            case 4 : { uint32_t u; std::memcpy(&u, pData, 4u); u = permuteBytes(u, mask); std::memcpy(pData, &u, 4u); break; }
+            default: { uint64_t u; std::memcpy(&u, pData, 8u); u = permuteBytes(u, mask); std::memcpy(pData, &u, 8u); break; }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+struct RuntimeEndianness
+{
+    static constexpr bool isSupported(Endianness e)
+    {
+        return isEndiannessSupported(e);
+    }
+
+    //! Порядок байт, который будет храниться в MemoryTraits
+    static constexpr Endianness adjustEndianness(Endianness e)
+    {
+        return e;
+    }
+
+    //! Фактический порядок байт
+    static constexpr Endianness getEndianness(Endianness e)
+    {
+        return e;
+    }
+
+    template<typename IntType>
+    static IntType fromMemory(IntType v, Endianness e)
+    {
+        if (e==Endianness::littleEndian)
+            return v;
+        return permuteBytes(v, getEndiannessPermutationMask(e, sizeof(IntType)));
+    }
+
+    template<typename IntType>
+    static IntType toMemory(IntType v, Endianness e)
+    {
+        return fromMemory(v, e);
+    }
+
+}; // struct RuntimeEndianness
+
+//----------------------------------------------------------------------------
+template<Endianness E>
+struct StaticEndianness
+{
+    static_assert(isEndiannessSupported(E), "StaticEndianness: unsupported endianness");
+
+    static constexpr const Endianness endianness = E;
+
+    static constexpr bool isSupported(Endianness e)
+    {
+        return e==E;
+    }
+
+    static constexpr Endianness adjustEndianness(Endianness)
+    {
+        return E;
+    }
+
+    static constexpr Endianness getEndianness(Endianness)
+    {
+        return E;
+    }
+
+    template<typename IntType>
+    static IntType fromMemory(IntType v, Endianness)
+    {
+        return permuteBytes(v, getEndiannessPermutationMask(E, sizeof(IntType)));
+    }
+
+    template<typename IntType>
+    static IntType toMemory(IntType v, Endianness)
+    {
+        return permuteBytes(v, getEndiannessPermutationMask(E, sizeof(IntType)));
+    }
+
+}; // struct StaticEndianness
+
+//----------------------------------------------------------------------------
+using LittleEndianStatic = StaticEndianness<Endianness::littleEndian>;
+using BigEndianStatic    = StaticEndianness<Endianness::bigEndian>;
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/endianness.h"
+
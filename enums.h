@@ -126,6 +126,41 @@ MARTY_CPP_ENUM_CLASS_DESERIALIZE_END( MemoryAccessResultCode, std::map, 1 )
 
 
 
+/*!  MemoryStorageType */
+//#!MemoryStorageType
+enum class MemoryStorageType : std::uint32_t
+{
+    unknown      = (std::uint32_t)(-1) /*!<  */,
+    invalid      = (std::uint32_t)(-1) /*!<  */,
+    undefined    = (std::uint32_t)(-1) /*!<  */,
+    hashMap      = 0x0000 /*!< Параграфы хранятся в unordered_map - подходит для сильно разреженной памяти */,
+    radixTable   = 0x0001 /*!< Многоуровневая radix-таблица (как page table) - прямая индексация по адресу */
+
+}; // enum 
+//#!
+
+MARTY_CPP_MAKE_ENUM_IS_FLAGS_FOR_NON_FLAGS_ENUM(MemoryStorageType)
+
+MARTY_CPP_ENUM_CLASS_SERIALIZE_BEGIN( MemoryStorageType, std::map, 1 )
+    MARTY_CPP_ENUM_CLASS_SERIALIZE_ITEM( MemoryStorageType::radixTable   , "RadixTable" );
+    MARTY_CPP_ENUM_CLASS_SERIALIZE_ITEM( MemoryStorageType::hashMap      , "HashMap"    );
+    MARTY_CPP_ENUM_CLASS_SERIALIZE_ITEM( MemoryStorageType::unknown      , "Unknown"    );
+MARTY_CPP_ENUM_CLASS_SERIALIZE_END( MemoryStorageType, std::map, 1 )
+
+MARTY_CPP_ENUM_CLASS_DESERIALIZE_BEGIN( MemoryStorageType, std::map, 1 )
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::radixTable   , "radix-table" );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::radixTable   , "radix_table" );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::radixTable   , "radixtable"  );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::hashMap      , "hash-map"    );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::hashMap      , "hash_map"    );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::hashMap      , "hashmap"     );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::unknown      , "undefined"   );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::unknown      , "invalid"     );
+    MARTY_CPP_ENUM_CLASS_DESERIALIZE_ITEM( MemoryStorageType::unknown      , "unknown"     );
+MARTY_CPP_ENUM_CLASS_DESERIALIZE_END( MemoryStorageType, std::map, 1 )
+
+
+
 /*!  MemoryOptionFlags */
 //#!MemoryOptionFlags
 enum class MemoryOptionFlags : std::uint32_t
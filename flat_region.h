@@ -0,0 +1,146 @@
+/*! \file
+    \brief Плоский (непрерывный) регион памяти
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Для заранее известных плотных регионов (ОЗУ, флешка и тп) держим один
+    непрерывный буфер в памяти хоста и параллельную ему карту валидности.
+    Карта валидности устроена так же, как в MemPage - numValidWords слов на
+    каждую страницу, поэтому кусок региона размером в страницу выглядит для
+    Memory так же, как обычная страница (см. MemPageRef).
+
+    Начало и размер региона выравнены на размер страницы, так что страница
+    либо целиком лежит в регионе, либо целиком вне его.
+
+    Данные региона могут разделяться между снимками памяти (см.
+    BasicMemory::snapshot), перед записью разделяемые данные копируются
+    целиком (unshare).
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "fixed_size_types.h"
+#include "mem_page.h"
+
+//----------------------------------------------------------------------------
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/flat_region.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<int PageBits>
+struct FlatMemoryRegion
+{
+    using page_type     = MemPage<PageBits>;
+    using page_ref_type = MemPageRef<PageBits>;
+    using valid_word_t  = typename page_type::valid_word_t;
+
+    struct Data
+    {
+        std::vector<byte_t>          bytes;
+        std::vector<valid_word_t>    validBits;
+    };
+
+    uint64_t                     base = 0;
+    uint64_t                     size = 0;
+    std::shared_ptr<Data>        pData; // Копия региона разделяет данные
+
+
+    FlatMemoryRegion() {}
+
+    FlatMemoryRegion(uint64_t b, uint64_t sz, byte_t fill)
+    : base(b), size(sz)
+    , pData(std::make_shared<Data>())
+    {
+        MARTY_MEM_ASSERT((b&page_type::pageMask)==0 && (sz&page_type::pageMask)==0);
+        pData->bytes.assign(std::size_t(sz), fill);
+        pData->validBits.assign(std::size_t(sz>>PageBits)*page_type::numValidWords, valid_word_t(0));
+    }
+
+    bool isShared() const
+    {
+        return pData.use_count()>1;
+    }
+
+    //! Делает собственную копию данных, если они разделяются с другим регионом. Возвращает true, если копирование было
+    bool unshare()
+    {
+        if (!isShared())
+            return false;
+
+        pData = std::make_shared<Data>(*pData);
+        return true;
+    }
+
+    const byte_t* getBytes(uint64_t addr) const
+    {
+        MARTY_MEM_ASSERT(contains(addr));
+        return &pData->bytes[std::size_t(addr-base)];
+    }
+
+    byte_t* getBytes(uint64_t addr)
+    {
+        MARTY_MEM_ASSERT(contains(addr));
+        return &pData->bytes[std::size_t(addr-base)];
+    }
+
+    bool contains(uint64_t addr) const
+    {
+        return addr-base < size;
+    }
+
+    bool contains(uint64_t addr, uint64_t sz) const
+    {
+        return contains(addr) && sz<=size-(addr-base);
+    }
+
+    bool intersects(uint64_t b, uint64_t sz) const
+    {
+        return b<base+size && base<b+sz;
+    }
+
+    page_ref_type getPageRef(uint64_t pageAddr)
+    {
+        MARTY_MEM_ASSERT(contains(pageAddr) && (pageAddr&page_type::pageMask)==0);
+        auto offs = std::size_t(pageAddr-base);
+        return page_ref_type(&pData->bytes[offs], &pData->validBits[(offs>>PageBits)*page_type::numValidWords]);
+    }
+
+    //! Помечает диапазон как записанный (например, при записи через указатель хоста)
+    void setValid(uint64_t addr, uint64_t sz)
+    {
+        MARTY_MEM_ASSERT(contains(addr, sz));
+        // Карта валидности региона непрерывна, поэтому смещение от начала региона работает так же, как смещение в странице
+        page_type::setRangeValid(&pData->validBits[0], std::size_t(addr-base), std::size_t(sz));
+    }
+
+}; // struct FlatMemoryRegion
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/flat_region.h"
+
@@ -169,25 +169,38 @@ public:
             throw invalid_address_difference(msg);
     }
 
-    // "Расстояние" от текущего до pv - сколько надо прибавить к текущему, чтобы получить pv => *pv > *this => dist = pv - dist
-    virtual ptrdiff_t distanceTo(const VirtualAddress *pv) const override
+    // "Расстояние" от текущего до other - сколько надо прибавить к текущему, чтобы получить other. Без виртуальных вызовов и dynamic_cast
+    ptrdiff_t distanceTo(const LinearAddress &other) const
     {
-        const LinearAddress &other = dynamic_cast<const LinearAddress&>(*pv); // Чтобы самим не кидать исключение bad_cast, используем ссылки
         //MARTY_MEM_ASSERT(m_incSize==other.m_incSize); // Разные размерности недопустимы
         checkCompat(other);
         checkDiff(other.m_address-m_address, "the difference in addresses is not a multiple of the type size");
         return ptrdiff_t(other.m_address - m_address) / ptrdiff_t(m_incSize);
     }
 
-    virtual bool equalTo(const VirtualAddress *pv) const override
+    bool equalTo(const LinearAddress &other) const
     {
-        const LinearAddress &other = dynamic_cast<const LinearAddress&>(*pv); // Чтобы самим не кидать исключение bad_cast, используем ссылки
         // MARTY_MEM_ASSERT(m_incSize==other.m_incSize); // Разные размерности недопустимы
         checkCompat(other);
         checkDiff(other.m_address-m_address, "the difference in addresses is not a multiple of the type size");
         return other.m_address == m_address;
     }
 
+    // "Расстояние" от текущего до pv - сколько надо прибавить к текущему, чтобы получить pv => *pv > *this => dist = pv - dist
+    virtual ptrdiff_t distanceTo(const VirtualAddress *pv) const override
+    {
+        if (pv->getAddressModel()!=VirtualAddressModel::linear)
+            throw std::bad_cast();
+        return distanceTo(static_cast<const LinearAddress&>(*pv));
+    }
+
+    virtual bool equalTo(const VirtualAddress *pv) const override
+    {
+        if (pv->getAddressModel()!=VirtualAddressModel::linear)
+            throw std::bad_cast();
+        return equalTo(static_cast<const LinearAddress&>(*pv));
+    }
+
     virtual SharedVirtualAddress clone() const override
     {
         auto copyOfThis = std::make_shared<LinearAddress>(*this);
@@ -207,10 +220,11 @@ public:
         return bits::countOnes(incSize)==1 && incSize<=8; // Не поддерживается гранулярность обращения к памяти больше 8 байт
     }
 
-    LinearAddress() {}
+    LinearAddress() : VirtualAddress(VirtualAddressModel::linear) {}
 
     LinearAddress(uint64_t addr, uint64_t inc=1, const LinearAddressTraits &traits=LinearAddressTraits{})
-    : m_address(addr)
+    : VirtualAddress(VirtualAddressModel::linear)
+    , m_address(addr)
     , m_incSize(inc)
     , m_traits (traits)
     , m_addressMask(bits::makeMask(int(traits.addressBitSize)))
@@ -260,6 +274,8 @@ public:
 
 }; // struct LinearAddress
 
+static_assert(IsInlineVirtualAddress<LinearAddress>::value, "LinearAddress must fit into InlineVirtualAddress");
+
 //----------------------------------------------------------------------------
 
 
@@ -6,23 +6,88 @@
 
 //----------------------------------------------------------------------------
 /*
-    Память представляем в виде unordered_map
+    Память представляем в виде набора страниц размером 2^PageBits байт (BasicMemory<PageBits, EndiannessPolicy, ...>).
+    Memory - это BasicMemory<4>, страницы по 16 байт (параграфы), как было исторически.
+    Порядок байт по умолчанию задаётся в MemoryTraits и проверяется при каждом обращении
+    (RuntimeEndianness). Если порядок байт известен при сборке, можно использовать
+    StaticEndianness<E> - тогда преобразование сводится к bswap или исчезает совсем
+    (см. LittleEndianMemory/BigEndianMemory).
+    Страницы хранятся либо в unordered_map (по умолчанию), либо в многоуровневой radix-таблице
+    (см. MemoryStorageType, задаётся в MemoryTraits для каждого экземпляра).
+
+    Для плотных регионов, известных заранее (ОЗУ, флешка), можно завести плоский регион
+    (addFlatRegion) - непрерывный буфер с картой валидности. Обращения в такой регион
+    не требуют поиска в map, также можно получить указатель на данные региона
+    (getFlatRegionReadPtr/getFlatRegionWritePtr). Адреса вне плоских регионов хранятся как и раньше.
+
+    Права доступа и значения по умолчанию (0x00 для ОЗУ, 0xFF для флешки и тп) можно задать
+    таблицей регионов (addAccessRegion) вместо переопределения checkAccessRights/getDefaultValue
+    в наследнике.
+
+    На выравненные на страницу диапазоны можно назначить обработчики MMIO (addMmioRange) - обращения
+    к ним уходят в обработчики, минуя страницы. Флаги таких страниц кешируются в TLB вместе со страницей,
+    поэтому обычные обращения платят только проверкой флага (см. page_hooks.h). Так же, флагами страниц,
+    реализованы точки наблюдения (addWatchpoint) и отметки страниц кода для обнаружения
+    самомодифицирующегося кода (markCodePages).
+
+    Проверка прав и значения по умолчанию вызываются через политики AccessPolicy/DefaultValuePolicy
+    (см. access_policy.h). Memory использует виртуальные checkAccessRights/getDefaultValue;
+    RegionTableMemory обращается к таблице регионов напрямую, UncheckedMemory не проверяет права
+    вовсе - в обоих случаях вызовы встраиваются в код доступа.
+
+    Можно включить отслеживание изменённых страниц (setDirtyTracking) - каждая запись отмечает страницу
+    в разреженной битовой карте (см. dirty_bitmap.h), collectDirty() выдаёт изменённые диапазоны, clearDirty()
+    сбрасывает отметки. Выключенное отслеживание стоит одной проверки флага на запись.
+
+    Для алгоритмов STL диапазон памяти можно обойти кусками (segments) - внешний итератор по страницам,
+    внутренний - непрерывный диапазон байт хоста. copy(first, last, out) между итераторами памяти и буферами
+    хоста (найдётся через ADL) копирует блоками, а не поэлементно. Квалифицированный std::copy эти перегрузки
+    не находит и копирует поэлементно - надо писать copy без квалификации или marty::mem::copy.
+
+    Записанные участки можно перебрать по возрастанию адресов (forEachValidChunk/forEachValidExtent) - они
+    строятся по картам валидности, без перебора адресов в промежутках между ними. Адреса страниц хранилища
+    дополнительно ведутся в упорядоченном индексе (page_index.h), поэтому запросы по диапазону адресов
+    и поиск ближайшего записанного адреса (findNextValidAddress) стоят O(log n + k).
+
+    snapshot() делает снимок памяти без копирования данных - страницы разделяются со снимком
+    (со счётчиком ссылок) и копируются только при первой записи.
+
+    Страницы можно размещать в std::pmr::memory_resource (MemoryTraits::pPageMemoryResource)
+    или в собственном пуле (MemoryTraits::usePageArena). Собственный пул освобождается
+    при разрушении памяти целиком, без обхода страниц. Узлы unordered_map по-прежнему
+    выделяются из кучи, поэтому для быстрого заполнения больших образов пул лучше
+    сочетать с MemoryStorageType::radixTable.
 
 */
 
 //----------------------------------------------------------------------------
+#include "access_policy.h"
 #include "assert.h"
 #include "bits.h"
+#include "dirty_bitmap.h"
+#include "endianness.h"
 #include "enums.h"
 #include "exceptions.h"
+#include "flat_region.h"
+#include "mem_page.h"
+#include "mem_tlb.h"
+#include "page_hooks.h"
+#include "page_index.h"
+#include "radix_table.h"
+#include "region_table.h"
 #include "types.h"
 #include "utils.h"
 
 //
 #include <array>
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 //----------------------------------------------------------------------------
 
@@ -117,183 +182,715 @@ struct MemoryIteratorBaseImpl
 
 
 //----------------------------------------------------------------------------
-template<typename IntType> struct MemoryIterator;
-template<typename IntType> struct ConstMemoryIterator;
+template< int PageBits
+        , typename EndiannessPolicy   = RuntimeEndianness
+        , typename AccessPolicy       = VirtualAccessPolicy
+        , typename DefaultValuePolicy = VirtualDefaultValuePolicy
+        >
+class BasicMemory;
+
+//! Память с 16-байтными страницами (параграфами)
+using Memory = BasicMemory<4>;
+
+//! Память с порядком байт, заданным на этапе компиляции
+using LittleEndianMemory = BasicMemory<4, LittleEndianStatic>;
+using BigEndianMemory    = BasicMemory<4, BigEndianStatic>;
+
+//! Память без виртуальных вызовов на каждое обращение - права доступа и значения по умолчанию берутся из таблицы регионов
+using RegionTableMemory  = BasicMemory<4, RuntimeEndianness, RegionTableAccessPolicy, RegionTableDefaultValuePolicy>;
+
+//! Память без проверки прав доступа
+using UncheckedMemory    = BasicMemory<4, RuntimeEndianness, NoAccessCheckPolicy, FlagsDefaultValuePolicy>;
+
+template<typename IntType, typename MemoryType=Memory> struct MemoryIterator;
+template<typename IntType, typename MemoryType=Memory> struct ConstMemoryIterator;
 //----------------------------------------------------------------------------
 
 
 
-namespace details
+//----------------------------------------------------------------------------
+//! Результат блочного доступа - код и количество фактически обработанных байт
+struct MemoryBlockAccessResult
 {
+    MemoryAccessResultCode    resultCode   = MemoryAccessResultCode::accessGranted;
+    std::size_t               numProcessed = 0;
 
-static constexpr const uint16_t getAlignedValueValidBitsArray16[16] = { 0x0001u, 0x0002u, 0x0004u, 0x0008u, 0x0010u, 0x0020u, 0x0040u, 0x0080u, 0x0100u, 0x0200u, 0x0400u, 0x0800u, 0x1000u, 0x2000u, 0x4000u, 0x8000u };
-static constexpr const uint16_t getAlignedValueValidBitsArray8 [ 8] = { 0x0003u, 0x000Cu, 0x0030u, 0x00C0u, 0x0300u, 0x0C00u, 0x3000u, 0xC000u };
-static constexpr const uint16_t getAlignedValueValidBitsArray4 [ 4] = { 0x000Fu, 0x00F0u, 0x0F00u, 0xF000u };
-static constexpr const uint16_t getAlignedValueValidBitsArray2 [ 2] = { 0x00FFu, 0xFF00u };
+}; // struct MemoryBlockAccessResult
 
-inline constexpr uint16_t getAlignedValueValidBits1(uint64_t addr)
+//----------------------------------------------------------------------------
+//! Окно выборки инструкций - указатель на непрерывные валидные байты памяти (см. BasicMemory::fetchWindow)
+struct MemoryFetchWindow
 {
-    auto idx = addr & 0x0Fu;
-    return getAlignedValueValidBitsArray16[idx];
-}
+    MemoryAccessResultCode    resultCode = MemoryAccessResultCode::accessGranted;
+    const byte_t             *pData      = 0;
+    std::size_t               size       = 0; // 0 - прямой доступ невозможен, читаем обычным образом
 
-inline constexpr uint16_t getAlignedValueValidBits2(uint64_t addr)
-{
-    auto idx = (addr & 0x0Fu)>>1;
-    return getAlignedValueValidBitsArray8[idx];
-}
+}; // struct MemoryFetchWindow
 
-inline constexpr uint16_t getAlignedValueValidBits4(uint64_t addr)
+//----------------------------------------------------------------------------
+//! Непрерывный участок записанных (валидных) байт памяти (см. BasicMemory::forEachValidChunk/forEachValidExtent)
+struct MemoryExtent
 {
-    auto idx = (addr & 0x0Fu)>>2;
-    return getAlignedValueValidBitsArray4[idx];
-}
+    uint64_t                  addr  = 0;
+    uint64_t                  size  = 0;
+    const byte_t             *pData = 0; // Данные участка, если они лежат одним куском (в одной странице или плоском регионе), иначе 0
+
+    // Участок как непрерывный диапазон байт хоста - для алгоритмов STL. Без данных - пустой диапазон
+    const byte_t* begin() const { return pData; }
+    const byte_t* end()   const { return pData ? pData+std::size_t(size) : pData; }
 
-inline constexpr uint16_t getAlignedValueValidBits8(uint64_t addr)
+}; // struct MemoryExtent
+
+//----------------------------------------------------------------------------
+//! Внешний итератор по кускам памяти (см. BasicMemory::segments), каждый кусок - непрерывный диапазон байт (MemoryExtent)
+template<typename MemoryType>
+struct MemorySegmentIterator
 {
-    auto idx = (addr & 0x0Fu)>>3;
-    return getAlignedValueValidBitsArray2[idx];
-}
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = MemoryExtent;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const MemoryExtent*;
+    using reference         = const MemoryExtent&;
 
-} // namespace details
+    const MemoryType    *pMemory   = 0;
+    uint64_t             remaining = 0; // Включая текущий кусок. 0 - конец
+    MemoryExtent         segment;
+
+
+    MemorySegmentIterator() {}
+
+    MemorySegmentIterator(const MemoryType *pm, uint64_t addr, uint64_t size) : pMemory(pm), remaining(size)
+    {
+        segment.addr = addr;
+        loadSegment();
+    }
+
+    void loadSegment()
+    {
+        if (remaining)
+            segment = pMemory->getSegment(segment.addr, remaining);
+    }
+
+    const MemoryExtent& operator*()  const { return segment; }
+    const MemoryExtent* operator->() const { return &segment; }
+
+    MemorySegmentIterator& operator++()     /* pre */
+    {
+        MARTY_MEM_ASSERT(remaining);
+        remaining    -= segment.size;
+        segment.addr += segment.size;
+        loadSegment();
+        return *this;
+    }
+
+    MemorySegmentIterator  operator++(int)  /* post */  { auto cp = *this; ++*this; return cp; }
+
+    bool operator==(const MemorySegmentIterator &other) const { return remaining==other.remaining; }
+    bool operator!=(const MemorySegmentIterator &other) const { return remaining!=other.remaining; }
+
+}; // struct MemorySegmentIterator
 
 //----------------------------------------------------------------------------
+//! Диапазон [addr, addr+size), разбитый на куски - для range-for: for(const auto &seg : mem.segments(a, n)) for(auto b : seg) ...
+template<typename MemoryType>
+struct MemorySegmentRange
+{
+    const MemoryType    *pMemory = 0;
+    uint64_t             addr    = 0;
+    uint64_t             size    = 0;
 
+    MemorySegmentIterator<MemoryType> begin() const { return MemorySegmentIterator<MemoryType>(pMemory, addr, size); }
+    MemorySegmentIterator<MemoryType> end()   const { return MemorySegmentIterator<MemoryType>(pMemory, addr+size, 0); }
 
+}; // struct MemorySegmentRange
 
 //----------------------------------------------------------------------------
 struct MemoryTraits
 {
     Endianness           endianness         = Endianness::littleEndian; // bigEndian
     MemoryOptionFlags    memoryOptionFlags  = MemoryOptionFlags::defaultFf;
+    MemoryStorageType    storageType        = MemoryStorageType::hashMap;
+
+#if defined(MARTY_MEM_HAS_PMR)
+    std::pmr::memory_resource *pPageMemoryResource = 0;     // Ресурс для страниц. Должен пережить память и все её снимки
+    bool                       usePageArena        = false; // Собственный пул страниц (если pPageMemoryResource не задан)
+#endif
 
 }; // struct MemoryTraits
 
 
 //----------------------------------------------------------------------------
-struct MemPara
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy>
+class BasicMemory
 {
-    uint16_t   validBits = 0; // единичный бит говорит, что память была ранее присвоена, 0 - память неинициализирована. Младшие биты соответствуют младшим адресам
-    byte_t     bytes[16]  = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
 
-}; // struct MemPara
+public:
 
-//----------------------------------------------------------------------------
+    using page_type        = MemPage<PageBits>;
+    using page_ref_type    = MemPageRef<PageBits>;
+    using flat_region_type = FlatMemoryRegion<PageBits>;
+    using page_hooks_type  = MemoryPageHooks<PageBits>;
 
+    static constexpr const int         pageBits = PageBits;
+    static constexpr const std::size_t pageSize = page_type::pageSize;
+    static constexpr const uint64_t    pageMask = page_type::pageMask;
 
 
-//----------------------------------------------------------------------------
-class Memory
-{
-    using memory_map_type = std::unordered_map<uint64_t, MemPara>;
+private:
+
+    // Страницы хранятся по указателю и могут разделяться между снимками памяти (см. snapshot)
+    using shared_page_type  = SharedMemPage<PageBits>;
+    using memory_map_type   = std::unordered_map<uint64_t, shared_page_type*>;
+    using memory_radix_type = RadixTable<shared_page_type, 64-PageBits>; // ключ - номер страницы (адрес>>PageBits)
 
     memory_map_type                             m_memMap;
+    memory_radix_type                           m_memRadix;
+    SortedPageIndex                             m_pageIndex;   // Адреса страниц хранилища по возрастанию (плоские регионы не входят)
+    std::vector<flat_region_type>               m_flatRegions; // Отсортированы по адресу начала
+    MemoryRegionTable<PageBits>                 m_regionTable; // Права доступа и значения по умолчанию для диапазонов адресов
+    page_hooks_type                             m_pageHooks;   // Страницы с обработчиками (MMIO, точки наблюдения, страницы кода)
+    DirtyPageBitmap<PageBits>                   m_dirtyPages;  // Изменённые страницы (если отслеживание включено)
     MemoryTraits                                m_memoryTraits;
 
-    // Кешируем итераторы, чтобы при последовательном доступе поиск не производился
-    // Да, он вроде бы линейный, но тем не менее
-    mutable memory_map_type::const_iterator     m_cachedReadIter ;
-    mutable memory_map_type::iterator           m_cachedWriteIter;
+    // Кешируем найденные страницы в TLB, отдельно для чтения и записи, чтобы при перемежающемся доступе
+    // (код/стек/данные) поиск не производился.
+    // Страницы не перемещаются, буферы плоских регионов - тоже, пока регион существует. При удалении страниц TLB сбрасывается.
+    // В TLB записи не попадают страницы, разделяемые со снимками - запись в них всегда идёт через поиск и copy-on-write
+    mutable MemPageTlb<PageBits>                m_readTlb;
+    mutable MemPageTlb<PageBits>                m_writeTlb;
+    mutable MemoryTlbStats                      m_tlbStats;
 
     uint64_t                                    m_addressValidMin = 0xFFFFFFFFFFFFFFFFull;
     uint64_t                                    m_addressValidMax = 0ull;
 
+#if defined(MARTY_MEM_HAS_PMR)
+    // Все страницы экземпляра выделяются из m_pPageResource (0 - обычные new/delete).
+    // Снимки разделяют страницы, поэтому разделяют и ресурс; собственный пул живёт, пока жив хоть один снимок
+    std::shared_ptr<std::pmr::memory_resource>  m_pPageArena;
+    std::pmr::memory_resource                  *m_pPageResource = 0;
+#endif
+
 
 
     static bool checkTraits(const MemoryTraits &traits)
     {
-        return traits.endianness==Endianness::littleEndian || traits.endianness==Endianness::bigEndian;; // bigEndian;
+        if (traits.storageType!=MemoryStorageType::hashMap && traits.storageType!=MemoryStorageType::radixTable)
+            return false;
+        return EndiannessPolicy::isSupported(traits.endianness);
     }
 
     static constexpr
-    uint64_t calcMemParaAlignedIndexClearBitsMask(uint64_t size)
+    uint64_t calcAlignedIndexClearBitsMask(uint64_t size)
     {
         return bits::makeMask(bits::getMsbPower(size));
     }
 
     static constexpr
-    uint16_t getAlignedValueValidBits(uint64_t addr, uint64_t size)
+    uint64_t calcPageAddress(uint64_t addr)
     {
-        return (size==1) ? details::getAlignedValueValidBits1(addr)
-                         : (size==2) ? details::getAlignedValueValidBits2(addr)
-                                     : (size==4) ? details::getAlignedValueValidBits4(addr)
-                                                 : details::getAlignedValueValidBits8(addr);
+        return addr&~pageMask;
     }
 
-    static
-    uint64_t calcParaAddress(uint64_t addr)
+    static constexpr
+    std::size_t calcPageAlignedIndex(uint64_t addr, uint64_t size)
     {
-        return addr&~0x0Full; // TODO: Проверить
+        return std::size_t((addr&pageMask) & ~calcAlignedIndexClearBitsMask(size));
     }
 
-    static constexpr
-    std::size_t calcMemParaAlignedIndex(uint64_t addr, uint64_t size)
+    bool isRadixStorage() const
+    {
+        return m_memoryTraits.storageType==MemoryStorageType::radixTable;
+    }
+
+    void flushTlb() const
+    {
+        m_readTlb.flush();
+        m_writeTlb.flush();
+    }
+
+    // Регионов обычно немного, поэтому достаточно двоичного поиска по отсортированному вектору
+    flat_region_type* findFlatRegion(uint64_t addr) const
+    {
+        auto it = std::upper_bound( m_flatRegions.begin(), m_flatRegions.end(), addr
+                                  , [](uint64_t a, const flat_region_type &r) { return a<r.base; }
+                                  );
+        if (it==m_flatRegions.begin())
+            return 0;
+
+        --it;
+        return it->contains(addr) ? const_cast<flat_region_type*>(&*it) : (flat_region_type*)0;
+    }
+
+    shared_page_type* findPagedPageImpl(uint64_t pageAddr) const
+    {
+        if (isRadixStorage())
+            return m_memRadix.find(pageAddr>>PageBits);
+
+        auto it = m_memMap.find(pageAddr);
+        return it==m_memMap.end() ? (shared_page_type*)0 : it->second;
+    }
+
+    page_ref_type findPageImpl(uint64_t pageAddr) const
+    {
+        if (!m_flatRegions.empty())
+        {
+            auto pRegion = findFlatRegion(pageAddr);
+            if (pRegion)
+                return pRegion->getPageRef(pageAddr);
+        }
+
+        return page_ref_type(findPagedPageImpl(pageAddr));
+    }
+
+    page_ref_type getReadPage(uint64_t addr) const
+    {
+        auto pageAddr = calcPageAddress(addr);
+        page_ref_type page;
+        if (m_readTlb.find(pageAddr, page))
+        {
+            ++m_tlbStats.readHits;
+            return page;
+        }
+
+        ++m_tlbStats.readMisses;
+        page = findPageImpl(pageAddr);
+        page.hookFlags = m_pageHooks.findPageFlags(pageAddr, &page.hookIndex);
+        if (page || (page.hookFlags&page_hooks_type::mmio)!=0) // Отсутствующие страницы не кешируем - они могут появиться при записи
+            m_readTlb.insert(pageAddr, page);
+
+        return page;
+    }
+
+    // Поиск страницы для записи. Разделяемые со снимками страницы и регионы перед записью копируются (copy-on-write)
+    page_ref_type findWritablePageImpl(uint64_t pageAddr)
     {
-        uint64_t idx = addr&0x0Full;
-        auto alignmentBits = calcMemParaAlignedIndexClearBitsMask(size);
-        idx &= ~alignmentBits; // TODO: Проверить
-        return std::size_t(idx);
+        if (!m_flatRegions.empty())
+        {
+            auto pRegion = findFlatRegion(pageAddr);
+            if (pRegion)
+            {
+                if (pRegion->unshare())
+                    flushTlb(); // В TLB могут остаться ссылки на страницы старой копии региона
+                return pRegion->getPageRef(pageAddr);
+            }
+        }
+
+        auto pPage = findPagedPageImpl(pageAddr);
+        if (pPage && pPage->isShared())
+            pPage = unsharePage(pageAddr, pPage);
+
+        return page_ref_type(pPage);
     }
 
-    memory_map_type::const_iterator getReadMemIterator(uint64_t addr) const
+    page_ref_type getWritePage(uint64_t addr)
     {
-        if (m_cachedReadIter==m_memMap.end())
+        auto pageAddr = calcPageAddress(addr);
+        page_ref_type page;
+        if (m_writeTlb.find(pageAddr, page))
         {
-            m_cachedReadIter = m_memMap.find(calcParaAddress(addr));
-            return m_cachedReadIter;
+            ++m_tlbStats.writeHits;
+            return page;
         }
-        else if (m_cachedReadIter->first==calcParaAddress(addr))
+
+        ++m_tlbStats.writeMisses;
+        page = findWritablePageImpl(pageAddr);
+        page.hookFlags = m_pageHooks.findPageFlags(pageAddr, &page.hookIndex);
+        if (page || (page.hookFlags&page_hooks_type::mmio)!=0)
+            m_writeTlb.insert(pageAddr, page);
+
+        return page;
+    }
+
+    byte_t getPageFillByte() const
+    {
+        return ((m_memoryTraits.memoryOptionFlags&MemoryOptionFlags::defaultFf)!=0) ? byte_t(0xFFu) : byte_t(0u);
+    }
+
+    void initPageResource()
+    {
+    #if defined(MARTY_MEM_HAS_PMR)
+        m_pPageArena.reset();
+        m_pPageResource = m_memoryTraits.pPageMemoryResource;
+        if (!m_pPageResource && m_memoryTraits.usePageArena)
         {
-            return m_cachedReadIter;
+            m_pPageArena    = std::make_shared<std::pmr::unsynchronized_pool_resource>();
+            m_pPageResource = m_pPageArena.get();
+        }
+    #endif
+    }
+
+    template<typename... Args>
+    shared_page_type* newPage(Args&&... args) const
+    {
+    #if defined(MARTY_MEM_HAS_PMR)
+        if (m_pPageResource)
+            return new (m_pPageResource->allocate(sizeof(shared_page_type), alignof(shared_page_type))) shared_page_type(std::forward<Args>(args)...);
+    #endif
+        return new shared_page_type(std::forward<Args>(args)...);
+    }
+
+    // Новая страница заполняется значением по умолчанию для её адресов
+    shared_page_type* allocPage(uint64_t pageAddr) const
+    {
+        auto pPage = newPage(getPageFillByte());
+
+        if (!m_regionTable.empty())
+        {
+            for(uint64_t offs=0; offs!=uint64_t(pageSize); )
+            {
+                auto spanSize = m_regionTable.calcSpanSize(pageAddr+offs, uint64_t(pageSize)-offs);
+                std::memset(&pPage->bytes[std::size_t(offs)], int(byte_t(DefaultValuePolicy::getDefaultValue(*this, pageAddr+offs, 1, m_memoryTraits.memoryOptionFlags))), std::size_t(spanSize));
+                offs += spanSize;
+            }
+        }
+
+        return pPage;
+    }
+
+    shared_page_type* clonePage(const shared_page_type &page) const
+    {
+        return newPage(page);
+    }
+
+    void releasePage(const shared_page_type *pPage) const
+    {
+        if (!pPage->release())
+            return;
+
+    #if defined(MARTY_MEM_HAS_PMR)
+        if (m_pPageResource)
+        {
+            pPage->~shared_page_type();
+            m_pPageResource->deallocate(const_cast<shared_page_type*>(pPage), sizeof(shared_page_type), alignof(shared_page_type));
+            return;
+        }
+    #endif
+
+        delete pPage;
+    }
+
+    // Заменяет разделяемую страницу на собственную копию
+    shared_page_type* unsharePage(uint64_t pageAddr, shared_page_type *pPage)
+    {
+        auto pNewPage = clonePage(*pPage);
+
+        if (isRadixStorage())
+        {
+            m_memRadix.erase(pageAddr>>PageBits);
+            m_memRadix.insert(pageAddr>>PageBits, pNewPage);
         }
         else
         {
-            m_cachedReadIter = m_memMap.find(calcParaAddress(addr));
-            return m_cachedReadIter;
+            m_memMap[pageAddr] = pNewPage;
         }
+
+        releasePage(pPage);
+        m_readTlb.invalidate(pageAddr);
+
+        return pNewPage;
     }
 
-    memory_map_type::iterator getWriteMemIterator(uint64_t addr) const
+    // Страницы в плоских регионах всегда существуют, сюда попадаем только для адресов вне регионов
+    page_ref_type insertPage(uint64_t addr)
     {
-        auto ncThis = const_cast<Memory*>(this);
-        if (m_cachedWriteIter==ncThis->m_memMap.end())
+        auto pageAddr = calcPageAddress(addr);
+
+        shared_page_type *pPage = 0;
+        if (isRadixStorage())
         {
-            m_cachedWriteIter = ncThis->m_memMap.find(calcParaAddress(addr));
-            return m_cachedWriteIter;
+            pPage = m_memRadix.find(pageAddr>>PageBits);
+            if (!pPage)
+            {
+                pPage = m_memRadix.insert(pageAddr>>PageBits, allocPage(pageAddr));
+                m_pageIndex.insert(pageAddr);
+            }
         }
-        else if (m_cachedWriteIter->first==calcParaAddress(addr))
+        else
         {
-            return m_cachedWriteIter;
+            auto p = m_memMap.emplace(pageAddr, (shared_page_type*)0);
+            if (p.second)
+            {
+                p.first->second = allocPage(pageAddr);
+                m_pageIndex.insert(pageAddr);
+            }
+            pPage = p.first->second;
         }
+
+        auto page = page_ref_type(pPage);
+        page.hookFlags = m_pageHooks.findPageFlags(pageAddr, &page.hookIndex);
+        m_writeTlb.insert(pageAddr, page);
+
+        return page;
+    }
+
+    // Переносит ранее записанные данные страницы в плоский регион и удаляет страницу
+    void moveRegionPageFromPaged(flat_region_type &region, uint64_t pageAddr)
+    {
+        shared_page_type *pPage = findPagedPageImpl(pageAddr);
+        if (!pPage)
+            return;
+
+        auto ref = region.getPageRef(pageAddr);
+        std::memcpy(ref.bytes    , &pPage->bytes[0]    , sizeof(pPage->bytes));
+        std::memcpy(ref.validBits, &pPage->validBits[0], sizeof(pPage->validBits));
+
+        if (isRadixStorage())
+            m_memRadix.erase(pageAddr>>PageBits);
         else
+            m_memMap.erase(pageAddr);
+
+        releasePage(pPage);
+    }
+
+    void clearPages()
+    {
+        m_memRadix.forEach([this](uint64_t, shared_page_type *pPage) { releasePage(pPage); });
+        m_memRadix.clear();
+
+        for(const auto &kv : m_memMap)
+            releasePage(kv.second);
+        m_memMap.clear();
+
+        m_pageIndex.clear();
+    }
+
+    // Копирует страницы и регионы другого экземпляра - либо полностью, либо разделяя их (для снимков)
+    void copyPagesFrom(const BasicMemory &other, bool bShare)
+    {
+        auto copyPage = [this, bShare](shared_page_type *pPage) -> shared_page_type*
+        {
+            if (!bShare)
+                return clonePage(*pPage);
+            pPage->addRef();
+            return pPage;
+        };
+
+        other.m_memRadix.forEach([&](uint64_t key, shared_page_type *pPage) { m_memRadix.insert(key, copyPage(pPage)); });
+
+        m_memMap.reserve(other.m_memMap.size());
+        for(const auto &kv : other.m_memMap)
+            m_memMap.emplace(kv.first, copyPage(kv.second));
+
+        m_pageIndex   = other.m_pageIndex;
+        m_flatRegions = other.m_flatRegions;
+        if (!bShare)
+        {
+            for(auto &r : m_flatRegions)
+                r.unshare();
+        }
+    }
+
+    // Обходит участки валидных байт в [first, last] по возрастанию адресов. Handler - bool(const MemoryExtent &chunk), false - прекратить обход
+    template<typename Handler>
+    bool forEachValidChunkImpl(uint64_t first, uint64_t last, Handler &h) const
+    {
+        using valid_word_t = typename page_type::valid_word_t;
+
+        // Первый плоский регион, заканчивающийся не раньше first
+        auto flatIt = std::upper_bound( m_flatRegions.begin(), m_flatRegions.end(), first
+                                      , [](uint64_t a, const flat_region_type &r) { return a<r.base; }
+                                      );
+        if (flatIt!=m_flatRegions.begin() && std::prev(flatIt)->contains(first))
+            --flatIt;
+
+        const auto &pageKeys = m_pageIndex.getKeys();
+        auto pageIt = std::lower_bound(pageKeys.begin(), pageKeys.end(), calcPageAddress(first));
+
+        // Плоские регионы и страницы хранилища не пересекаются - сливаем две упорядоченные последовательности
+        for(;;)
         {
-            m_cachedWriteIter = ncThis->m_memMap.find(calcParaAddress(addr));
-            return m_cachedWriteIter;
+            bool bFlat = flatIt!=m_flatRegions.end() && flatIt->base<=last;
+            bool bPage = pageIt!=pageKeys.end() && *pageIt<=last;
+            if (!bFlat && !bPage)
+                break;
+
+            if (bFlat && (!bPage || flatIt->base<*pageIt))
+            {
+                const flat_region_type &r = *flatIt++;
+                const byte_t *pBytes = r.getBytes(r.base);
+                uint64_t lo = std::max(first, r.base) - r.base;
+                uint64_t hi = std::min(last , r.base+(r.size-1u)) - r.base;
+                bool bContinue = page_type::forEachValidRun( static_cast<const valid_word_t*>(&r.pData->validBits[0]), std::size_t(lo), std::size_t(hi-lo+1u)
+                                                           , [&](std::size_t offs, std::size_t len) { return h(MemoryExtent{r.base+offs, uint64_t(len), pBytes+offs}); }
+                                                           );
+                if (!bContinue)
+                    return false;
+            }
+            else
+            {
+                uint64_t pageAddr = *pageIt++;
+                const page_type *pPage = findPagedPageImpl(pageAddr);
+                MARTY_MEM_ASSERT(pPage);
+                uint64_t lo = std::max(first, pageAddr) - pageAddr;
+                uint64_t hi = std::min(last , pageAddr+pageMask) - pageAddr;
+                bool bContinue = page_type::forEachValidRun( &pPage->validBits[0], std::size_t(lo), std::size_t(hi-lo+1u)
+                                                           , [&](std::size_t offs, std::size_t len) { return h(MemoryExtent{pageAddr+offs, uint64_t(len), &pPage->bytes[offs]}); }
+                                                           );
+                if (!bContinue)
+                    return false;
+            }
         }
+
+        return true;
+    }
+
+    // Обходит максимальные участки валидных байт в [first, last]. Handler - void(const MemoryExtent &extent)
+    template<typename Handler>
+    void forEachValidExtentImpl(uint64_t first, uint64_t last, Handler &h) const
+    {
+        MemoryExtent ext;
+        bool         bHasExt = false;
+
+        auto chunkHandler = [&](const MemoryExtent &chunk)
+        {
+            if (bHasExt && ext.addr+ext.size==chunk.addr)
+            {
+                ext.size  += chunk.size;
+                ext.pData  = 0;
+                return true;
+            }
+
+            if (bHasExt)
+                h(static_cast<const MemoryExtent&>(ext));
+
+            ext     = chunk;
+            bHasExt = true;
+            return true;
+        };
+
+        forEachValidChunkImpl(first, last, chunkHandler);
+
+        if (bHasExt)
+            h(static_cast<const MemoryExtent&>(ext));
+    }
+
+    // Последний адрес диапазона [addr, addr+size), с обрезкой по концу адресного пространства
+    static
+    uint64_t calcRangeLast(uint64_t addr, uint64_t size)
+    {
+        MARTY_MEM_ASSERT(size!=0);
+        return addr+(size-1u)<addr ? ~uint64_t(0) : addr+(size-1u);
     }
 
     static
     bool checkAddressAligned(uint64_t addr, uint64_t size)
     {
-        auto alignmentBits = calcMemParaAlignedIndexClearBitsMask(size);
+        auto alignmentBits = calcAlignedIndexClearBitsMask(size);
         return ((addr&alignmentBits)==0);
     }
 
 
+    // Список точек наблюдения просматривается только для страниц, помеченных флагом нужного вида
+    void checkPageWatchpoints(uint32_t hookFlags, uint64_t addr, uint64_t size, MemoryAccessRights requestedMode) const
+    {
+        auto watchFlag = page_hooks_type::getAccessWatchFlag(requestedMode);
+        if ((hookFlags&watchFlag)!=0)
+            m_pageHooks.checkWatchpoints(addr, size, watchFlag);
+    }
+
+    // Первая запись в страницу кода - снимаем отметку (флаги страницы закешированы в TLB) и сообщаем об этом
+    void onCodePageWrite(uint64_t addr)
+    {
+        auto pageAddr = calcPageAddress(addr);
+        m_pageHooks.onCodePageWrite(pageAddr);
+        m_readTlb.invalidate(pageAddr);
+        m_writeTlb.invalidate(pageAddr);
+    }
+
+    // Для плоских регионов, которые заполняются, минуя страницы
+    void checkRangeCodePagesOnWrite(uint64_t addr, uint64_t size)
+    {
+        auto lastPageAddr = calcPageAddress(addr+(size-1u));
+        for(uint64_t pageAddr=calcPageAddress(addr); ; pageAddr+=pageSize)
+        {
+            if (m_pageHooks.isCodePage(pageAddr))
+                onCodePageWrite(pageAddr);
+            if (pageAddr==lastPageAddr)
+                break;
+        }
+    }
+
+    // Обращения к MMIO. Значение - как в памяти, младший байт по младшему адресу
+    MemoryAccessResultCode readMmio(uint64_t *pResVal, uint64_t addr, uint64_t size, uint32_t mmioIndex) const
+    {
+        const auto &range = m_pageHooks.getMmioRange(mmioIndex);
+        if (!range.readHandler)
+            return MemoryAccessResultCode::accessDenied;
+
+        uint64_t val = 0;
+        auto res = range.readHandler(addr, size, &val);
+        if (res==MemoryAccessResultCode::accessGranted && pResVal)
+            *pResVal = val&bits::makeByteSizeMask(int(size));
+
+        return res;
+    }
+
+    MemoryAccessResultCode writeMmio(uint64_t val, uint64_t addr, uint64_t size, uint32_t mmioIndex) const
+    {
+        const auto &range = m_pageHooks.getMmioRange(mmioIndex);
+        if (!range.writeHandler)
+            return MemoryAccessResultCode::accessDenied;
+
+        return range.writeHandler(addr, size, val&bits::makeByteSizeMask(int(size)));
+    }
+
+    // Блочные обращения к MMIO - побайтно. В pNumProcessed - количество обработанных байт
+    MemoryAccessResultCode readMmioBytes(byte_t *pDst, uint64_t addr, uint64_t n, uint32_t mmioIndex, uint64_t *pNumProcessed) const
+    {
+        for(uint64_t i=0; i!=n; ++i)
+        {
+            uint64_t val = 0;
+            auto res = readMmio(&val, addr+i, 1, mmioIndex);
+            if (res!=MemoryAccessResultCode::accessGranted)
+            {
+                *pNumProcessed = i;
+                return res;
+            }
+            pDst[i] = byte_t(val);
+        }
+
+        *pNumProcessed = n;
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Шаблон начинается с позиции patternOffs, для записи из буфера - pPattern=pSrc, patternSize=n, patternOffs=0
+    MemoryAccessResultCode writeMmioBytes(const byte_t *pPattern, std::size_t patternSize, std::size_t patternOffs, uint64_t addr, uint64_t n, uint32_t mmioIndex, uint64_t *pNumProcessed) const
+    {
+        for(uint64_t i=0; i!=n; ++i)
+        {
+            auto res = writeMmio(pPattern[(patternOffs+std::size_t(i))%patternSize], addr+i, 1, mmioIndex);
+            if (res!=MemoryAccessResultCode::accessGranted)
+            {
+                *pNumProcessed = i;
+                return res;
+            }
+        }
+
+        *pNumProcessed = n;
+        return MemoryAccessResultCode::accessGranted;
+    }
+
     // Не кидает исключений, не производит конвертацию в/из big-endian
     MemoryAccessResultCode readAlignedImpl(uint64_t *pResVal, uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
     {
         MARTY_MEM_ASSERT(size==1u || size==2u || size==4u || size==8u);
 
-        auto res = checkAccessRights(addr, sizeof(*pResVal), requestedMode);
+        auto res = AccessPolicy::checkAccessRights(*this, addr, size, requestedMode);
         if (res!=MemoryAccessResultCode::accessGranted)
             return res;
 
         if (!checkAddressAligned(addr, size))
             return MemoryAccessResultCode::unalignedMemoryAccess; // TODO: Проверить
 
-        auto it = getReadMemIterator(addr);
-        if (it==m_memMap.end())
+        auto page = getReadPage(addr);
+        if (page.hookFlags) // Обычные страницы платят только этой проверкой
+        {
+            checkPageWatchpoints(page.hookFlags, addr, size, requestedMode);
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+                return readMmio(pResVal, addr, size, page.hookIndex);
+        }
+
+        if (!page)
         {
             if ((memoryOptionFlags&MemoryOptionFlags::errorOnHitMiss)!=0) // Иначе - допустимо, и вернём на месте пустых байт 0 или 0xFF
             {
@@ -303,16 +900,17 @@ class Memory
             {
                 if (pResVal)
                 {
-                    *pResVal = getDefaultValue(addr, size, memoryOptionFlags);
+                    *pResVal = DefaultValuePolicy::getDefaultValue(*this, addr, size, memoryOptionFlags);
                 }
 
                 return MemoryAccessResultCode::accessGranted;
             }
         }
 
+        auto idxBase = calcPageAlignedIndex(addr, size);
+
         // Забиваем на preciseHitMiss
-        auto alignedValueValidBits = getAlignedValueValidBits(addr, size);
-        if ((it->second.validBits&alignedValueValidBits)!=alignedValueValidBits) // всё биты годные?
+        if (!page.checkAlignedValueValid(idxBase, std::size_t(size))) // всё биты годные?
         {
             if ((memoryOptionFlags&MemoryOptionFlags::errorOnHitMiss)!=0) // Иначе - допустимо, и вернём на месте пустых байт 0 или 0xFF
             {
@@ -320,18 +918,14 @@ class Memory
             }
         }
 
+        // Выровненное значение не может пересекать границу страницы, поэтому проверять заворот адреса не нужно.
+        // Младший байт лежит по младшему адресу - так же, как его кладёт writeAlignedImpl
         uint64_t resVal = 0;
 
-        auto idxBase = calcMemParaAlignedIndex(addr, size);
-        uint64_t testAddr = (addr&0x0Full)+idxBase;
-        for(std::size_t i=0u; i!=size; ++i)
+        for(std::size_t i=std::size_t(size); i!=0u; --i)
         {
-            uint64_t prevTestAddr = testAddr++;
-            if (prevTestAddr>testAddr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
-                return MemoryAccessResultCode::addressWrap;
-
             resVal <<= 8;
-            resVal |= it->second.bytes[idxBase+i];
+            resVal |= page.bytes[idxBase+i-1u];
         }
 
         if (pResVal)
@@ -345,137 +939,901 @@ class Memory
     {
         MARTY_MEM_ASSERT(size==1u || size==2u || size==4u || size==8u);
 
-        auto res = checkAccessRights(addr, sizeof(val), requestedMode);
-        if (res!=MemoryAccessResultCode::accessGranted)
+        auto res = AccessPolicy::checkAccessRights(*this, addr, size, requestedMode);
+        if (res!=MemoryAccessResultCode::accessGranted)
+            return res;
+
+        if (!checkAddressAligned(addr, size))
+            return MemoryAccessResultCode::unalignedMemoryAccess; // TODO: Проверить
+
+        if ((memoryOptionFlags&MemoryOptionFlags::writeSimulate)!=0)
+        {
+            return MemoryAccessResultCode::accessGranted; // Фактическую запись не производим
+        }
+
+        auto page = getWritePage(addr);
+        if (page.hookFlags)
+        {
+            checkPageWatchpoints(page.hookFlags, addr, size, requestedMode);
+            if ((page.hookFlags&page_hooks_type::code)!=0)
+                onCodePageWrite(addr);
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+                return writeMmio(val, addr, size, page.hookIndex);
+        }
+
+        if (!page)
+            page = insertPage(addr);
+
+        // Обновляем диапазон адресов
+        m_addressValidMin = std::min(m_addressValidMin, addr);
+        m_addressValidMax = std::max(m_addressValidMax, addr+size-1u);
+
+        auto idxBase = calcPageAlignedIndex(addr, size);
+
+        // Ставим биты валидности
+        page.setAlignedValueValid(idxBase, std::size_t(size));
+        m_dirtyPages.markDirty(addr, size);
+
+        for(std::size_t i=0u; i!=size; ++i, val>>=8)
+        {
+            page.bytes[idxBase+i] = uint8_t(val);
+        }
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Невыровненное значение размером size лежит не более чем на двух страницах.
+    // Права проверяем один раз на всё значение, каждую страницу ищем один раз.
+    // Не кидает исключений, не производит конвертацию в/из big-endian
+    MemoryAccessResultCode readUnalignedImpl(uint64_t *pResVal, uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode) const
+    {
+        MARTY_MEM_ASSERT(size>=1u && size<=8u);
+
+        if (addr+(size-1u)<addr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
+            return MemoryAccessResultCode::addressWrap;
+
+        auto res = AccessPolicy::checkAccessRights(*this, addr, size, requestedMode);
+        if (res!=MemoryAccessResultCode::accessGranted)
+            return res;
+
+        uint64_t resVal = 0;
+        for(uint64_t nDone=0; nDone!=size; )
+        {
+            auto partSize = calcPageChunkSize(addr, size-nDone);
+            auto page     = getReadPage(addr);
+            auto idx      = std::size_t(addr&pageMask);
+
+            if (page.hookFlags)
+                checkPageWatchpoints(page.hookFlags, addr, partSize, requestedMode);
+
+            uint64_t partVal = 0;
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+            {
+                res = readMmio(&partVal, addr, partSize, page.hookIndex);
+                if (res!=MemoryAccessResultCode::accessGranted)
+                    return res;
+            }
+            else if (!page)
+            {
+                if ((memoryOptionFlags&MemoryOptionFlags::errorOnHitMiss)!=0)
+                    return MemoryAccessResultCode::unassignedMemoryAccess;
+
+                partVal = DefaultValuePolicy::getDefaultValue(*this, addr, partSize, memoryOptionFlags);
+            }
+            else
+            {
+                if ((memoryOptionFlags&MemoryOptionFlags::errorOnHitMiss)!=0 && !page.checkRangeValid(idx, std::size_t(partSize)))
+                    return MemoryAccessResultCode::unassignedMemoryAccess;
+
+                for(std::size_t i=std::size_t(partSize); i!=0u; --i)
+                {
+                    partVal <<= 8;
+                    partVal |= page.bytes[idx+i-1u];
+                }
+            }
+
+            resVal |= partVal<<(8u*nDone); // Младший байт - по младшему адресу
+            addr   += partSize;
+            nDone  += partSize;
+        }
+
+        if (pResVal)
+            *pResVal = resVal;
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Не кидает исключений, не производит конвертацию в/из big-endian
+    MemoryAccessResultCode writeUnalignedImpl(uint64_t val, uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode)
+    {
+        MARTY_MEM_ASSERT(size>=1u && size<=8u);
+
+        if (addr+(size-1u)<addr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
+            return MemoryAccessResultCode::addressWrap;
+
+        auto res = AccessPolicy::checkAccessRights(*this, addr, size, requestedMode);
+        if (res!=MemoryAccessResultCode::accessGranted)
+            return res;
+
+        if ((memoryOptionFlags&MemoryOptionFlags::writeSimulate)!=0)
+            return MemoryAccessResultCode::accessGranted; // Фактическую запись не производим
+
+        for(uint64_t nDone=0; nDone!=size; )
+        {
+            auto partSize = calcPageChunkSize(addr, size-nDone);
+
+            auto page = getWritePage(addr);
+            if (page.hookFlags)
+            {
+                checkPageWatchpoints(page.hookFlags, addr, partSize, requestedMode);
+                if ((page.hookFlags&page_hooks_type::code)!=0)
+                    onCodePageWrite(addr);
+            }
+
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+            {
+                res = writeMmio(val, addr, partSize, page.hookIndex);
+                if (res!=MemoryAccessResultCode::accessGranted)
+                    return res;
+
+                val     = partSize<8u ? val>>(8u*partSize) : 0u;
+                addr   += partSize;
+                nDone  += partSize;
+                continue;
+            }
+
+            if (!page)
+                page = insertPage(addr);
+
+            auto idx = std::size_t(addr&pageMask);
+            page.setRangeValid(idx, std::size_t(partSize));
+            m_dirtyPages.markDirty(addr, partSize);
+            for(std::size_t i=0u; i!=partSize; ++i, val>>=8)
+                page.bytes[idx+i] = uint8_t(val);
+
+            m_addressValidMin = std::min(m_addressValidMin, addr);
+            m_addressValidMax = std::max(m_addressValidMax, addr+partSize-1u);
+
+            addr  += partSize;
+            nDone += partSize;
+        }
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Перестановка байт элемента массива: порядок байт памяти плюс порядок байт хоста (перестановки j^mask складываются через xor)
+    unsigned getArrayPermutationMask(std::size_t elemSize) const
+    {
+        return getEndiannessPermutationMask(EndiannessPolicy::getEndianness(m_memoryTraits.endianness), elemSize)
+             ^ getHostEndiannessPermutationMask(elemSize);
+    }
+
+    // Размер куска, который от addr до конца страницы, но не больше n
+    static
+    uint64_t calcPageChunkSize(uint64_t addr, uint64_t n)
+    {
+        return std::min(n, uint64_t(pageSize)-(addr&pageMask));
+    }
+
+    // Блочное чтение - постранично, memcpy целыми кусками. Права доступа проверяются один раз на кусок.
+    // В pNumProcessed возвращается количество прочитанных байт (кратно кускам)
+    MemoryAccessResultCode readBlockImpl(byte_t *pDst, uint64_t addr, uint64_t n, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode, uint64_t *pNumProcessed) const
+    {
+        uint64_t nProcessed = 0;
+
+        while(nProcessed!=n)
+        {
+            auto chunkSize = calcPageChunkSize(addr, n-nProcessed);
+
+            auto res = AccessPolicy::checkAccessRights(*this, addr, chunkSize, requestedMode);
+            if (res!=MemoryAccessResultCode::accessGranted)
+            {
+                if (pNumProcessed)
+                    *pNumProcessed = nProcessed;
+                return res;
+            }
+
+            auto page = getReadPage(addr);
+            auto idx  = std::size_t(addr&pageMask);
+
+            if (page.hookFlags)
+                checkPageWatchpoints(page.hookFlags, addr, chunkSize, requestedMode);
+
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+            {
+                uint64_t nMmio = 0;
+                res = readMmioBytes(pDst, addr, chunkSize, page.hookIndex, &nMmio);
+                if (res!=MemoryAccessResultCode::accessGranted)
+                {
+                    if (pNumProcessed)
+                        *pNumProcessed = nProcessed+nMmio;
+                    return res;
+                }
+            }
+            else
+            {
+                if ((memoryOptionFlags&MemoryOptionFlags::errorOnHitMiss)!=0 && (!page || !page.checkRangeValid(idx, std::size_t(chunkSize))))
+                {
+                    if (pNumProcessed)
+                        *pNumProcessed = nProcessed;
+                    return MemoryAccessResultCode::unassignedMemoryAccess;
+                }
+
+                if (page)
+                    std::memcpy(pDst, &page.bytes[idx], std::size_t(chunkSize));
+                else // Значение по умолчанию запрашиваем один раз на кусок (или на часть куска, лежащую в одном регионе)
+                {
+                    for(uint64_t offs=0; offs!=chunkSize; )
+                    {
+                        auto spanSize = m_regionTable.calcSpanSize(addr+offs, chunkSize-offs);
+                        std::memset(pDst+offs, int(byte_t(DefaultValuePolicy::getDefaultValue(*this, addr+offs, 1, memoryOptionFlags))), std::size_t(spanSize));
+                        offs += spanSize;
+                    }
+                }
+            }
+
+            pDst       += chunkSize;
+            addr       += chunkSize;
+            nProcessed += chunkSize;
+        }
+
+        if (pNumProcessed)
+            *pNumProcessed = nProcessed;
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Блочная запись. Сначала проверяем права на весь диапазон, чтобы при ошибке ничего не было записано, потом пишем постранично.
+    // Ошибка обработчика MMIO может прервать уже начатую запись
+    MemoryAccessResultCode writeBlockImpl(const byte_t *pSrc, uint64_t addr, uint64_t n, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode, uint64_t *pNumProcessed)
+    {
+        if (pNumProcessed)
+            *pNumProcessed = 0;
+
+        if (n && addr+(n-1u)<addr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
+            return MemoryAccessResultCode::addressWrap;
+
+        for(uint64_t a=addr, nChecked=0; nChecked!=n; )
+        {
+            auto chunkSize = calcPageChunkSize(a, n-nChecked);
+            auto res = AccessPolicy::checkAccessRights(*this, a, chunkSize, requestedMode);
+            if (res!=MemoryAccessResultCode::accessGranted)
+                return res;
+            a        += chunkSize;
+            nChecked += chunkSize;
+        }
+
+        if ((memoryOptionFlags&MemoryOptionFlags::writeSimulate)==0)
+        {
+            for(uint64_t nWritten=0; nWritten!=n; )
+            {
+                auto chunkSize = calcPageChunkSize(addr, n-nWritten);
+
+                auto page = getWritePage(addr);
+                if (page.hookFlags)
+                {
+                    checkPageWatchpoints(page.hookFlags, addr, chunkSize, requestedMode);
+                    if ((page.hookFlags&page_hooks_type::code)!=0)
+                        onCodePageWrite(addr);
+                }
+
+                if ((page.hookFlags&page_hooks_type::mmio)!=0)
+                {
+                    uint64_t nMmio = 0;
+                    auto res = writeMmioBytes(pSrc, std::size_t(chunkSize), 0, addr, chunkSize, page.hookIndex, &nMmio);
+                    if (res!=MemoryAccessResultCode::accessGranted)
+                    {
+                        if (pNumProcessed)
+                            *pNumProcessed = nWritten+nMmio;
+                        return res;
+                    }
+
+                    pSrc     += chunkSize;
+                    addr     += chunkSize;
+                    nWritten += chunkSize;
+                    continue;
+                }
+
+                if (!page)
+                    page = insertPage(addr);
+
+                auto idx = std::size_t(addr&pageMask);
+                std::memcpy(&page.bytes[idx], pSrc, std::size_t(chunkSize));
+                page.setRangeValid(idx, std::size_t(chunkSize));
+                m_dirtyPages.markDirty(addr, chunkSize);
+
+                m_addressValidMin = std::min(m_addressValidMin, addr);
+                m_addressValidMax = std::max(m_addressValidMax, addr+chunkSize-1u);
+
+                pSrc     += chunkSize;
+                addr     += chunkSize;
+                nWritten += chunkSize;
+            }
+        }
+
+        if (pNumProcessed)
+            *pNumProcessed = n;
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    // Заполняет n байт повторяющимся шаблоном, patternOffs - позиция в шаблоне для первого байта
+    static
+    void fillBytesWithPattern(byte_t *pDst, std::size_t n, const byte_t *pPattern, std::size_t patternSize, std::size_t patternOffs)
+    {
+        if (patternSize==1u)
+        {
+            std::memset(pDst, int(*pPattern), n);
+            return;
+        }
+
+        while(n)
+        {
+            auto partSize = std::min(n, patternSize-patternOffs);
+            std::memcpy(pDst, pPattern+patternOffs, partSize);
+            pDst       += partSize;
+            n          -= partSize;
+            patternOffs = 0;
+        }
+    }
+
+    // Кусок заполнения - до конца плоского региона или до конца страницы
+    uint64_t calcFillChunkSize(uint64_t addr, uint64_t n) const
+    {
+        if (!m_flatRegions.empty())
+        {
+            auto pRegion = findFlatRegion(addr);
+            if (pRegion)
+                return std::min(n, pRegion->size-(addr-pRegion->base));
+        }
+
+        return calcPageChunkSize(addr, n);
+    }
+
+    // Заполнение шаблоном. Страницы заполняются целиком и маска валидности ставится пословно,
+    // плоские регионы - одним куском. Сначала проверяем права на весь диапазон, чтобы при ошибке ничего не было записано
+    // (кроме ошибок обработчиков MMIO)
+    MemoryAccessResultCode fillImpl(uint64_t addr, uint64_t n, const byte_t *pPattern, std::size_t patternSize, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode)
+    {
+        if (!pPattern || !patternSize)
+            return MemoryAccessResultCode::memoryFillError;
+
+        if (!n)
+            return MemoryAccessResultCode::accessGranted;
+
+        if (addr+(n-1u)<addr) // Диапазон заворачивается через конец адресного пространства
+            return MemoryAccessResultCode::memoryFillError;
+
+        for(uint64_t a=addr, nChecked=0; nChecked!=n; )
+        {
+            auto chunkSize = calcFillChunkSize(a, n-nChecked);
+            auto res = AccessPolicy::checkAccessRights(*this, a, chunkSize, requestedMode);
+            if (res!=MemoryAccessResultCode::accessGranted)
+                return res;
+            a        += chunkSize;
+            nChecked += chunkSize;
+        }
+
+        if ((memoryOptionFlags&MemoryOptionFlags::writeSimulate)!=0)
+            return MemoryAccessResultCode::accessGranted;
+
+        // Диапазон валидных адресов расширяем только кусками, ушедшими в хранилище - не в обработчики MMIO
+        for(uint64_t nFilled=0; nFilled!=n; )
+        {
+            auto patternOffs = std::size_t(nFilled%patternSize);
+            auto pRegion     = m_flatRegions.empty() ? (flat_region_type*)0 : findFlatRegion(addr);
+
+            if (pRegion)
+            {
+                auto chunkSize = std::min(n-nFilled, pRegion->size-(addr-pRegion->base));
+                if (!m_pageHooks.empty()) // Регион заполняется одним куском, минуя страницы
+                {
+                    m_pageHooks.checkWatchpoints(addr, chunkSize, page_hooks_type::getAccessWatchFlag(requestedMode));
+                    checkRangeCodePagesOnWrite(addr, chunkSize);
+                }
+                if (pRegion->unshare())
+                    flushTlb();
+                fillBytesWithPattern(pRegion->getBytes(addr), std::size_t(chunkSize), pPattern, patternSize, patternOffs);
+                pRegion->setValid(addr, chunkSize);
+                m_dirtyPages.markDirty(addr, chunkSize);
+                m_addressValidMin = std::min(m_addressValidMin, addr);
+                m_addressValidMax = std::max(m_addressValidMax, addr+chunkSize-1u);
+                addr    += chunkSize;
+                nFilled += chunkSize;
+                continue;
+            }
+
+            auto chunkSize = calcPageChunkSize(addr, n-nFilled);
+
+            auto page = getWritePage(addr);
+            if (page.hookFlags)
+            {
+                checkPageWatchpoints(page.hookFlags, addr, chunkSize, requestedMode);
+                if ((page.hookFlags&page_hooks_type::code)!=0)
+                    onCodePageWrite(addr);
+            }
+
+            if ((page.hookFlags&page_hooks_type::mmio)!=0)
+            {
+                uint64_t nMmio = 0;
+                auto res = writeMmioBytes(pPattern, patternSize, patternOffs, addr, chunkSize, page.hookIndex, &nMmio);
+                if (res!=MemoryAccessResultCode::accessGranted)
+                    return res;
+
+                addr    += chunkSize;
+                nFilled += chunkSize;
+                continue;
+            }
+
+            if (!page)
+                page = insertPage(addr);
+
+            auto idx = std::size_t(addr&pageMask);
+            fillBytesWithPattern(&page.bytes[idx], std::size_t(chunkSize), pPattern, patternSize, patternOffs);
+            page.setRangeValid(idx, std::size_t(chunkSize));
+            m_dirtyPages.markDirty(addr, chunkSize);
+            m_addressValidMin = std::min(m_addressValidMin, addr);
+            m_addressValidMax = std::max(m_addressValidMax, addr+chunkSize-1u);
+
+            addr    += chunkSize;
+            nFilled += chunkSize;
+        }
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+
+
+public:
+
+    virtual ~BasicMemory()
+    {
+    #if defined(MARTY_MEM_HAS_PMR)
+        if (m_pPageArena && m_pPageArena.use_count()==1)
+            return; // Пул только наш, страницы в нём ни с кем не разделяются - освобождаем всё разом вместе с пулом
+    #endif
+        clearPages();
+    }
+
+    BasicMemory()
+    {
+        m_memoryTraits.endianness = EndiannessPolicy::adjustEndianness(m_memoryTraits.endianness);
+    }
+
+    BasicMemory(const MemoryTraits &memTraits)
+    : m_memMap(), m_memoryTraits(memTraits)
+    {
+        m_memoryTraits.endianness = EndiannessPolicy::adjustEndianness(m_memoryTraits.endianness);
+
+        // check traits here
+        MARTY_MEM_ASSERT(checkTraits(m_memoryTraits));
+        initPageResource();
+    }
+
+    //! Полная копия. Для дешёвой копии с разделением страниц см. snapshot
+    BasicMemory(const BasicMemory &other)
+    : m_regionTable(other.m_regionTable)
+    , m_pageHooks(other.m_pageHooks)
+    , m_dirtyPages(other.m_dirtyPages)
+    , m_memoryTraits(other.m_memoryTraits)
+    , m_addressValidMin(other.m_addressValidMin)
+    , m_addressValidMax(other.m_addressValidMax)
+    {
+        initPageResource();
+        copyPagesFrom(other, false);
+    }
+
+    BasicMemory& operator=(const BasicMemory &other)
+    {
+        if (&other==this)
+            return *this;
+
+        clearPages();
+        m_regionTable  = other.m_regionTable;
+        m_pageHooks    = other.m_pageHooks;
+        m_dirtyPages   = other.m_dirtyPages;
+        m_memoryTraits = other.m_memoryTraits;
+        initPageResource();
+        copyPagesFrom(other, false);
+
+        flushTlb();
+        m_addressValidMin = other.m_addressValidMin;
+        m_addressValidMax = other.m_addressValidMax;
+
+        return *this;
+    }
+
+    BasicMemory(BasicMemory && other)
+    : m_memMap(std::exchange(other.m_memMap, memory_map_type()))
+    , m_memRadix(std::move(other.m_memRadix))
+    , m_pageIndex(std::exchange(other.m_pageIndex, SortedPageIndex()))
+    , m_flatRegions(std::exchange(other.m_flatRegions, std::vector<flat_region_type>()))
+    , m_regionTable(std::exchange(other.m_regionTable, MemoryRegionTable<PageBits>()))
+    , m_pageHooks(std::exchange(other.m_pageHooks, page_hooks_type()))
+    , m_dirtyPages(std::move(other.m_dirtyPages))
+    , m_memoryTraits(std::exchange(other.m_memoryTraits, MemoryTraits()))
+    , m_addressValidMin(std::exchange(other.m_addressValidMin, 0xFFFFFFFFFFFFFFFFull))
+    , m_addressValidMax(std::exchange(other.m_addressValidMax, 0ull))
+    #if defined(MARTY_MEM_HAS_PMR)
+    , m_pPageArena(std::move(other.m_pPageArena))
+    , m_pPageResource(std::exchange(other.m_pPageResource, (std::pmr::memory_resource*)0))
+    #endif
+    {
+        other.flushTlb();
+    }
+
+    BasicMemory& operator=(BasicMemory && other)
+    {
+        if (&other==this)
+            return *this;
+
+        std::swap(m_memMap, other.m_memMap);
+        m_memRadix.swap(other.m_memRadix);
+        m_pageIndex.swap(other.m_pageIndex);
+        std::swap(m_flatRegions, other.m_flatRegions);
+        std::swap(m_regionTable, other.m_regionTable);
+        std::swap(m_pageHooks, other.m_pageHooks);
+        std::swap(m_dirtyPages, other.m_dirtyPages);
+        std::swap(m_memoryTraits, other.m_memoryTraits);
+        std::swap(m_addressValidMin, other.m_addressValidMin);
+        std::swap(m_addressValidMax, other.m_addressValidMax);
+    #if defined(MARTY_MEM_HAS_PMR)
+        std::swap(m_pPageArena, other.m_pPageArena);
+        std::swap(m_pPageResource, other.m_pPageResource);
+    #endif
+        flushTlb();
+        other.flushTlb();
+
+        return *this;
+    }
+
+    //! Делает dst снимком данной памяти. Страницы разделяются и копируются только при первой записи в них (copy-on-write), как в dst, так и здесь
+    /*! Плоские регионы разделяются и копируются целиком. Указатели, ранее полученные от getFlatRegionWritePtr, становятся недействительными
+     */
+    void snapshotTo(BasicMemory &dst) const
+    {
+        if (&dst==this)
+            return;
+
+        dst.clearPages();
+    #if defined(MARTY_MEM_HAS_PMR)
+        dst.m_pPageArena      = m_pPageArena;
+        dst.m_pPageResource   = m_pPageResource;
+    #endif
+        dst.copyPagesFrom(*this, true);
+        dst.m_regionTable     = m_regionTable;
+        dst.m_pageHooks       = m_pageHooks;
+        dst.m_dirtyPages      = m_dirtyPages;
+        dst.m_memoryTraits    = m_memoryTraits;
+        dst.m_addressValidMin = m_addressValidMin;
+        dst.m_addressValidMax = m_addressValidMax;
+        dst.flushTlb();
+
+        m_writeTlb.flush(); // Наши страницы теперь тоже разделяемые, запись в них должна пройти через copy-on-write
+    }
+
+    //! Снимок памяти за O(число страниц), без копирования данных
+    BasicMemory snapshot() const
+    {
+        BasicMemory res;
+        snapshotTo(res);
+        return res;
+    }
+
+    const MemoryTraits& getMemoryTraits() const { return m_memoryTraits; }
+
+    //! Счётчики попаданий/промахов TLB - для подбора размера страницы и настройки
+    const MemoryTlbStats& getTlbStats() const { return m_tlbStats; }
+    void resetTlbStats() { m_tlbStats = MemoryTlbStats(); }
+
+    //! Заводит плоский регион [base, base+size). base и size должны быть выравнены на размер страницы, регионы не должны пересекаться
+    /*! Ранее записанные в этот диапазон данные переносятся в регион. Невалидные параметры - возвращаем false
+     */
+    bool addFlatRegion(uint64_t base, uint64_t size)
+    {
+        if (size==0 || (base&pageMask)!=0 || (size&pageMask)!=0 || base+size<base)
+            return false;
+
+        for(const auto &r : m_flatRegions)
+        {
+            if (r.intersects(base, size))
+                return false;
+        }
+
+        if (m_pageHooks.intersectsMmio(base, size))
+            return false;
+
+        auto it = std::upper_bound( m_flatRegions.begin(), m_flatRegions.end(), base
+                                  , [](uint64_t a, const flat_region_type &r) { return a<r.base; }
+                                  );
+        it = m_flatRegions.insert(it, flat_region_type(base, size, getPageFillByte()));
+
+        for(uint64_t pageAddr=base; pageAddr!=base+size; pageAddr+=pageSize)
+            moveRegionPageFromPaged(*it, pageAddr);
+        m_pageIndex.eraseRange(base, base+(size-1u));
+
+        flushTlb();
+
+        return true;
+    }
+
+    //! Указатель на данные плоского региона для чтения, если диапазон [addr, addr+size) целиком лежит в одном регионе, иначе 0
+    /*! Проверки прав доступа и валидности не производятся. Указатель действителен до следующего addFlatRegion.
+        Указатель на запись также становится недействительным после снимка (snapshot/snapshotTo)
+     */
+    const byte_t* getFlatRegionReadPtr(uint64_t addr, uint64_t size) const
+    {
+        auto pRegion = findFlatRegion(addr);
+        if (!pRegion || !pRegion->contains(addr, size))
+            return 0;
+
+        return static_cast<const flat_region_type*>(pRegion)->getBytes(addr);
+    }
+
+    //! Окно до maxLen непрерывных валидных байт, начиная с addr - для декодирования инструкций переменной длины без побайтного чтения
+    /*! Права доступа проверяются один раз на всё окно. Окно заканчивается на границе страницы (в плоском регионе - на границе
+        региона), на первом невалидном байте и на странице с обработчиками (MMIO, точки наблюдения на исполнение).
+        size==0 при accessGranted - прямой доступ невозможен (байт по addr не записан, MMIO и тп), надо читать через read.
+        Указатель действителен до следующей модификации памяти
+     */
+    MemoryFetchWindow fetchWindow(uint64_t addr, std::size_t maxLen, MemoryAccessRights requestedMode=MemoryAccessRights::execute) const
+    {
+        MemoryFetchWindow res;
+
+        if (!maxLen)
+            return res;
+
+        // Страницы MMIO и страницы с точками наблюдения на этот вид обращения читаются только обычным образом
+        const uint32_t stopFlags = page_hooks_type::mmio | page_hooks_type::getAccessWatchFlag(requestedMode);
+
+        auto page = getReadPage(addr);
+        if ((page.hookFlags&stopFlags)!=0 || !page)
             return res;
 
-        if (!checkAddressAligned(addr, size))
-            return MemoryAccessResultCode::unalignedMemoryAccess; // TODO: Проверить
+        auto idx = std::size_t(addr&pageMask);
+        if (!page.checkRangeValid(idx, 1u))
+            return res;
 
-        auto it = getWriteMemIterator(addr); // Всегда дёргаем итератор
+        auto pRegion = m_flatRegions.empty() ? (flat_region_type*)0 : findFlatRegion(addr);
+        uint64_t limit = pRegion ? pRegion->size-(addr-pRegion->base) : uint64_t(pageSize)-idx;
+        limit = std::min(limit, uint64_t(maxLen));
 
-        if ((memoryOptionFlags&MemoryOptionFlags::writeSimulate)!=0)
+        // Считаем валидные байты постранично (в плоском регионе окно может пересекать страницы)
+        uint64_t len = 0;
+        for(uint64_t a=addr; len!=limit; )
         {
-            return MemoryAccessResultCode::accessGranted; // Фактическую запись не производим
+            auto pageRef = page;
+            if (a!=addr)
+            {
+                uint32_t hookIndex = 0;
+                if ((m_pageHooks.findPageFlags(a, &hookIndex)&stopFlags)!=0)
+                    break;
+                pageRef = pRegion->getPageRef(a);
+            }
+
+            auto offs      = std::size_t(a&pageMask);
+            auto chunkSize = std::size_t(std::min(limit-len, uint64_t(pageSize)-offs));
+
+            // Карта валидности просматривается пословно, нужен только участок, начинающийся с offs
+            std::size_t nValid = 0;
+            page_type::forEachValidRun( pageRef.validBits, offs, chunkSize
+                                      , [&](std::size_t runOffs, std::size_t runLen) { if (runOffs==offs) nValid = runLen; return false; }
+                                      );
+
+            len += nValid;
+            a   += nValid;
+            if (nValid!=chunkSize)
+                break;
         }
 
-        if (it==m_memMap.end())
+        res.resultCode = AccessPolicy::checkAccessRights(*this, addr, len, requestedMode);
+        if (res.resultCode!=MemoryAccessResultCode::accessGranted)
+            return res;
+
+        res.pData = &page.bytes[idx];
+        res.size  = std::size_t(len);
+        return res;
+    }
+
+    //! Непрерывный кусок памяти от addr длиной не больше maxLen - до конца страницы (в плоском регионе - до конца региона)
+    /*! pData==0 - у куска нет хранилища (страница не записывалась или это MMIO), его байты читаются через read.
+        Права доступа, валидность байт и точки наблюдения не проверяются. Указатель действителен до следующей модификации памяти
+     */
+    MemoryExtent getSegment(uint64_t addr, uint64_t maxLen) const
+    {
+        MemoryExtent res;
+        res.addr = addr;
+        res.size = calcFillChunkSize(addr, maxLen);
+
+        if (!m_flatRegions.empty())
         {
-            MemPara mp;
-            mp.validBits = 0;
-            uint8_t fill = ((m_memoryTraits.memoryOptionFlags&MemoryOptionFlags::defaultFf)!=0) ? uint8_t(0xFFu) : uint8_t(0u);
-            // m_memoryTraits.memoryOptionFlags  = MemoryOptionFlags::preciseHitMiss | MemoryOptionFlags::throwOnHitMiss | MemoryOptionFlags::defaultFF;
-            for(auto i=0u; i!=16u; ++i)
+            auto pRegion = findFlatRegion(addr);
+            if (pRegion)
             {
-                mp.bytes[i] = fill;
+                res.pData = static_cast<const flat_region_type*>(pRegion)->getBytes(addr);
+                return res;
             }
-
-            auto p = m_memMap.insert(std::make_pair(calcParaAddress(addr), mp));
-            it = m_cachedWriteIter = p.first;
         }
 
-        // Обновляем диапазон адресов
+        auto page = getReadPage(addr);
+        if (page && (page.hookFlags&page_hooks_type::mmio)==0)
+            res.pData = &page.bytes[std::size_t(addr&pageMask)];
+
+        return res;
+    }
+
+    //! Диапазон [addr, addr+size) по кускам (см. getSegment) - внешний итератор по страницам, внутренний - по байтам хоста
+    MemorySegmentRange<BasicMemory> segments(uint64_t addr, uint64_t size) const
+    {
+        return MemorySegmentRange<BasicMemory>{this, addr, size};
+    }
+
+    //! Указатель на данные плоского региона для записи. Весь диапазон сразу помечается как записанный (и изменённый)
+    byte_t* getFlatRegionWritePtr(uint64_t addr, uint64_t size)
+    {
+        auto pRegion = findFlatRegion(addr);
+        if (!pRegion || !pRegion->contains(addr, size) || size==0)
+            return 0;
+
+        if (pRegion->unshare())
+            flushTlb();
+
+        pRegion->setValid(addr, size);
+        m_dirtyPages.markDirty(addr, size);
+
         m_addressValidMin = std::min(m_addressValidMin, addr);
         m_addressValidMax = std::max(m_addressValidMax, addr+size-1u);
 
-        // Ставим биты валидности
-        auto alignedValueValidBits = getAlignedValueValidBits(addr, size);
-        it->second.validBits |= alignedValueValidBits;
+        return pRegion->getBytes(addr);
+    }
 
-        auto idxBase = calcMemParaAlignedIndex(addr, size);
-        uint64_t testAddr = (addr&0x0Full)+idxBase;
-        for(std::size_t i=0u; i!=size; ++i, val>>=8)
-        {
-            uint64_t prevTestAddr = testAddr++;
-            if (prevTestAddr>testAddr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
-                return MemoryAccessResultCode::addressWrap;
+    //! Назначает обработчики MMIO на диапазон [base, base+size). Обращения к нему не затрагивают хранилище страниц
+    /*! base и size должны быть выравнены на размер страницы, диапазон не должен пересекаться с другими диапазонами MMIO
+        и с плоскими регионами. Права доступа проверяются как обычно. Невалидные параметры - возвращаем false
+     */
+    bool addMmioRange(uint64_t base, uint64_t size, MmioReadHandler readHandler, MmioWriteHandler writeHandler)
+    {
+        if (size==0 || (base&pageMask)!=0 || (size&pageMask)!=0 || base+size<base)
+            return false;
+
+        if (m_pageHooks.intersectsMmio(base, size))
+            return false;
 
-            it->second.bytes[idxBase+i] = uint8_t(val);
+        for(const auto &r : m_flatRegions)
+        {
+            if (r.intersects(base, size))
+                return false;
         }
 
-        return MemoryAccessResultCode::accessGranted;
+        m_pageHooks.addMmioRange(base, size, std::move(readHandler), std::move(writeHandler));
+        flushTlb(); // Флаги страниц кешируются в TLB
+        return true;
+    }
+
+    void clearMmioRanges()
+    {
+        m_pageHooks.clearMmio();
+        flushTlb();
     }
 
+    const std::vector<MmioRange>& getMmioRanges() const { return m_pageHooks.getMmioRanges(); }
 
+    //! Точка наблюдения на диапазон [addr, addr+size). kind - комбинация read/write/execute
+    /*! Исполнением считается обращение с requestedMode==MemoryAccessRights::execute. Обращения через
+        указатели getFlatRegionReadPtr/getFlatRegionWritePtr не отслеживаются. Невалидные параметры - возвращаем false
+     */
+    bool addWatchpoint(uint64_t addr, uint64_t size, MemoryAccessRights kind)
+    {
+        if (size==0 || addr+(size-1u)<addr || (kind&MemoryAccessRights::executeReadWrite)==0)
+            return false;
 
-public:
+        m_pageHooks.addWatchpoint(addr, size, kind);
+        flushTlb();
+        return true;
+    }
 
-    virtual ~Memory() {}
+    bool removeWatchpoint(uint64_t addr, uint64_t size, MemoryAccessRights kind)
+    {
+        if (!m_pageHooks.removeWatchpoint(addr, size, kind))
+            return false;
 
-    Memory() : m_memMap(), m_cachedReadIter(m_memMap.end()), m_cachedWriteIter(m_memMap.end()) {}
+        flushTlb();
+        return true;
+    }
 
-    Memory(const MemoryTraits &memTraits)
-    : m_memMap(), m_memoryTraits(memTraits)
-    , m_cachedReadIter(m_memMap.end()), m_cachedWriteIter(m_memMap.end())
+    void clearWatchpoints()
     {
-        // check traits here
-        MARTY_MEM_ASSERT(checkTraits(m_memoryTraits));
+        m_pageHooks.clearWatchpoints();
+        flushTlb();
     }
 
-    Memory(const Memory &other)
-    : m_memMap(other.m_memMap), m_memoryTraits(other.m_memoryTraits)
-    , m_cachedReadIter(m_memMap.end()), m_cachedWriteIter(m_memMap.end())
-    , m_addressValidMin(other.m_addressValidMin)
-    , m_addressValidMax(other.m_addressValidMax)
-    {}
+    const std::vector<Watchpoint>& getWatchpoints() const { return m_pageHooks.getWatchpoints(); }
 
-    Memory& operator=(const Memory &other)
+    //! Помечает страницы диапазона как страницы кода. При первой записи в такую страницу отметка снимается и вызывается обработчик
+    /*! Гранулярность - страница (для Memory - 16 байт). Запись через getFlatRegionWritePtr не отслеживается
+     */
+    bool markCodePages(uint64_t addr, uint64_t size)
     {
-        if (&other==this)
-            return *this;
+        if (size==0 || addr+(size-1u)<addr)
+            return false;
 
-        m_memMap = other.m_memMap;
-        m_memoryTraits = other.m_memoryTraits;
-        m_cachedReadIter  = m_memMap.end();
-        m_cachedWriteIter = m_memMap.end();
-        m_addressValidMin = other.m_addressValidMin;
-        m_addressValidMax = other.m_addressValidMax;
+        m_pageHooks.markCodePages(addr, size);
+        flushTlb();
+        return true;
+    }
 
-        return *this;
+    bool unmarkCodePages(uint64_t addr, uint64_t size)
+    {
+        if (size==0 || addr+(size-1u)<addr)
+            return false;
+
+        m_pageHooks.unmarkCodePages(addr, size);
+        flushTlb();
+        return true;
     }
 
-    Memory(Memory && other)
-    : m_memMap(std::exchange(other.m_memMap, memory_map_type()))
-    , m_memoryTraits(std::exchange(other.m_memoryTraits, MemoryTraits()))
-    , m_cachedReadIter(std::exchange(other.m_cachedReadIter, m_memMap.end()))
-    , m_cachedWriteIter(std::exchange(other.m_cachedWriteIter, m_memMap.end()))
-    , m_addressValidMin(std::exchange(other.m_addressValidMin, 0xFFFFFFFFFFFFFFFFull))
-    , m_addressValidMax(std::exchange(other.m_addressValidMax, 0ull))
+    bool isCodePage(uint64_t addr) const { return m_pageHooks.isCodePage(calcPageAddress(addr)); }
+
+    void setCodePageWriteHandler(CodePageWriteHandler handler) { m_pageHooks.setCodePageWriteHandler(std::move(handler)); }
+
+    //! Обработчик срабатываний. Если не задан, срабатывания запоминаются (getWatchpointHits)
+    void setWatchpointHandler(WatchpointHandler handler) { m_pageHooks.setWatchpointHandler(std::move(handler)); }
+
+    const std::vector<WatchpointHit>& getWatchpointHits() const { return m_pageHooks.getWatchpointHits(); }
+    void clearWatchpointHits() { m_pageHooks.clearWatchpointHits(); }
+
+    //! Включает/выключает отслеживание изменённых страниц. При выключении накопленные отметки сохраняются
+    /*! Отмечается любая запись в хранилище (включая плоские регионы и getFlatRegionWritePtr), запись в MMIO не отмечается.
+        Гранулярность - страница
+     */
+    void setDirtyTracking(bool bEnable) { m_dirtyPages.setEnabled(bEnable); }
+    bool isDirtyTrackingEnabled() const { return m_dirtyPages.isEnabled(); }
+
+    //! Изменённые диапазоны (выравненные на страницу) по возрастанию адресов, соседние страницы склеены
+    std::vector<DirtyMemoryRange> collectDirty() const { return m_dirtyPages.collect(); }
+
+    bool isDirty(uint64_t addr) const { return m_dirtyPages.isDirty(addr); }
+
+    void clearDirty() { m_dirtyPages.clear(); }
+
+    //! Задаёт права доступа и байт по умолчанию для диапазона [base, base+size) (например, 0x00 для ОЗУ, 0xFF для флешки)
+    /*! Ранее заданные диапазоны, пересекающиеся с новым, перекрываются им. Невалидные параметры - возвращаем false
+     */
+    bool addAccessRegion(uint64_t base, uint64_t size, MemoryAccessRights rights, byte_t defaultByte)
     {
+        if (size==0 || base+size<=base)
+            return false;
+
+        m_regionTable.addRegion(base, size, rights, defaultByte);
+        return true;
     }
 
-    Memory& operator=(Memory && other)
+    void clearAccessRegions()
     {
-        std::exchange(m_memMap, other.m_memMap);
-        std::exchange(m_memoryTraits, other.m_memoryTraits);
-        std::exchange(m_cachedReadIter, other.m_cachedReadIter);
-        std::exchange(m_cachedWriteIter, other.m_cachedWriteIter);
-        std::exchange(m_addressValidMin, other.m_addressValidMin);
-        std::exchange(m_addressValidMax, other.m_addressValidMax);
+        m_regionTable.clear();
+    }
 
-        return *this;
+    //! Права доступа для адресов, не попавших ни в один диапазон. По умолчанию - executeReadWrite
+    void setUnmappedAccessRights(MemoryAccessRights rights)
+    {
+        m_regionTable.setUnmappedAccessRights(rights);
     }
 
-    const MemoryTraits& getMemoryTraits() const { return m_memoryTraits; }
+    const MemoryRegionTable<PageBits>& getAccessRegionTable() const { return m_regionTable; }
 
+    // Вызываются через AccessPolicy/DefaultValuePolicy, по умолчанию (VirtualAccessPolicy/VirtualDefaultValuePolicy) - на каждое обращение.
+    // Для других политик переопределение в наследнике ни на что не влияет
     virtual MemoryAccessResultCode checkAccessRights(uint64_t addr, uint64_t size, MemoryAccessRights requestedMode) const
     {
-        // В наследнике тут можно проверить права доступа к региону памяти
-        MARTY_USED(addr);
-        MARTY_USED(size);
-        MARTY_USED(requestedMode);
-
-        return MemoryAccessResultCode::accessGranted;
+        // В наследнике тут можно проверить права доступа к региону памяти; по умолчанию используется таблица регионов
+        return RegionTableAccessPolicy::checkAccessRights(*this, addr, size, requestedMode);
     }
 
     virtual uint64_t getDefaultValue(uint64_t addr, uint64_t size, MemoryOptionFlags memoryOptionFlags) const
     {
-        MARTY_USED(addr);
         // В наследнике, в зависимости от назначения региона памяти, можно возвращать разные значения.
-        // Так, при симуляции STM32 чистая флешка возвращает 0xFF, а ОЗУ - нули
-        if ((memoryOptionFlags&MemoryOptionFlags::defaultFf)!=0)
-            return bits::makeByteSizeMask(int(size));
-        return 0;
+        // Так, при симуляции STM32 чистая флешка возвращает 0xFF, а ОЗУ - нули. По умолчанию используется таблица регионов
+        return RegionTableDefaultValuePolicy::getDefaultValue(*this, addr, size, memoryOptionFlags);
     }
 
 
@@ -491,33 +1849,19 @@ public:
                 return res;
 
         }
-        else // Собираем побайтно
+        else // Собираем из одной или двух страниц
         {
             if ((memoryOptionFlags&MemoryOptionFlags::restrictUnalignedAccess)!=0) // Разрешен только выровненный доступ?
                 return MemoryAccessResultCode::unalignedMemoryAccess; // Тогда облом
 
-            std::size_t size = sizeof(IntType);
-            for(auto i=0u; i!=size; ++i)
-            {
-                val64 <<= 8;
-                uint8_t byte = 0;
-                auto res = read(&byte, addr, memoryOptionFlags, requestedMode);
-                if (res!=MemoryAccessResultCode::accessGranted)
-                    return res;
-                val64 |= byte;
-                uint64_t prevAddr = addr++;
-                if (prevAddr>addr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
-                    return MemoryAccessResultCode::addressWrap;
-            }
+            auto res = readUnalignedImpl(&val64, addr, sizeof(IntType), memoryOptionFlags, requestedMode);
+            if (res!=MemoryAccessResultCode::accessGranted)
+                return res;
         }
 
         if (pResVal)
         {
-            *pResVal = IntType(val64);
-            if (m_memoryTraits.endianness==Endianness::bigEndian)
-            {
-                *pResVal = bits::swapBytes(*pResVal);
-            }
+            *pResVal = EndiannessPolicy::fromMemory(IntType(val64), m_memoryTraits.endianness);
         }
 
         return MemoryAccessResultCode::accessGranted;
@@ -526,14 +1870,9 @@ public:
     template< typename IntType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
     MemoryAccessResultCode write(IntType val, uint64_t addr, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
     {
-        memoryOptionFlags &= MemoryOptionFlags::writeSimulate; // Чтобы случайно не просочилось
-
-        if (m_memoryTraits.endianness==Endianness::bigEndian)
-        {
-            val = bits::swapBytes(val);
-        }
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
 
-        uint64_t val64 = uint64_t(val);
+        uint64_t val64 = uint64_t(EndiannessPolicy::toMemory(val, m_memoryTraits.endianness));
 
         if (checkAddressAligned(addr, sizeof(IntType)))
         {
@@ -544,32 +1883,8 @@ public:
             return MemoryAccessResultCode::unalignedMemoryAccess; // Тогда облом
 
 
-        // А вот тут надо побайтно писать.
-
-        // Для начала цикл в холостую - если какая ошибка выскочит, то ничего фактически изменено не будет
-
-        uint64_t orgAddr  = addr;
-        // uint64_t orgVal64 = val64;
-        std::size_t size = sizeof(IntType);
-        for(auto i=0u; i!=size; ++i /* , val64>>=8 */ ) // реальное значение можно не вычислять - всё равно записи не производится
-        {
-            auto res = writeAlignedImpl( 0 /* val64 */ , addr, 1, memoryOptionFlags|MemoryOptionFlags::writeSimulate, requestedMode);
-            if (res!=MemoryAccessResultCode::accessGranted)
-                return res;
-            uint64_t prevAddr = addr++;
-            if (prevAddr>addr && (memoryOptionFlags&MemoryOptionFlags::errorOnAddressWrap)!=0)
-                return MemoryAccessResultCode::addressWrap;
-        }
-
-        addr  = orgAddr ;
-        // val64 = orgVal64;
-        for(auto i=0u; i!=size; ++i, ++addr, val64>>=8)
-        {
-            // Результат можно не проверять
-            writeAlignedImpl(val64, addr, 1, memoryOptionFlags, requestedMode);
-        }
-
-        return MemoryAccessResultCode::accessGranted;
+        // Раскладываем по одной или двум страницам. Все проверки делаются до фактической записи
+        return writeUnalignedImpl(val64, addr, sizeof(IntType), memoryOptionFlags, requestedMode);
 
     }
 
@@ -585,20 +1900,20 @@ public:
         return write(val, addr, m_memoryTraits.memoryOptionFlags, requestedMode);
     }
 
+    //! Дописывает в конец v прочитанные байты. При ошибке в v остаются байты, прочитанные до неё
     MemoryAccessResultCode read(byte_vector_t &v, uint64_t addr, uint64_t nRead, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
     {
-        v.reserve(std::size_t(nRead));
+        if (!nRead)
+            return MemoryAccessResultCode::accessGranted;
 
-        for(uint64_t i=0u; i!=nRead; ++i, ++addr)
-        {
-            byte_t b = 0;
-            auto rc = read(&b, addr, memoryOptionFlags, requestedMode);
-            if (rc!=MemoryAccessResultCode::accessGranted)
-                return rc;
-            v.push_back(b);
-        }
+        auto sizeOrg = v.size();
+        v.resize(sizeOrg+std::size_t(nRead));
 
-        return MemoryAccessResultCode::accessGranted;
+        uint64_t nProcessed = 0;
+        auto rc = readBlockImpl(&v[sizeOrg], addr, nRead, memoryOptionFlags, requestedMode, &nProcessed);
+        v.resize(sizeOrg+std::size_t(nProcessed));
+
+        return rc;
     }
 
     MemoryAccessResultCode read(byte_vector_t &v, uint64_t addr, uint64_t nRead, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
@@ -606,43 +1921,191 @@ public:
         return read(v, addr, nRead, m_memoryTraits.memoryOptionFlags, requestedMode);
     }
 
-    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, uint64_t nWrite, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
+    //! Чтение в буфер вызывающего, без промежуточных контейнеров
+    MemoryBlockAccessResult readBytes(byte_t *pDst, uint64_t addr, std::size_t n, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        MARTY_MEM_ASSERT(pDst || !n);
+        uint64_t nProcessed = 0;
+        auto rc = readBlockImpl(pDst, addr, uint64_t(n), memoryOptionFlags, requestedMode, &nProcessed);
+        return MemoryBlockAccessResult{rc, std::size_t(nProcessed)};
+    }
+
+    MemoryBlockAccessResult readBytes(byte_t *pDst, uint64_t addr, std::size_t n, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        return readBytes(pDst, addr, n, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    //! Запись из буфера вызывающего. При ошибке ничего не записывается, numProcessed==0
+    MemoryBlockAccessResult writeBytes(const byte_t *pSrc, uint64_t addr, std::size_t n, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        MARTY_MEM_ASSERT(pSrc || !n);
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
+        uint64_t nProcessed = 0;
+        auto rc = writeBlockImpl(pSrc, addr, uint64_t(n), memoryOptionFlags, requestedMode, &nProcessed);
+        return MemoryBlockAccessResult{rc, std::size_t(nProcessed)};
+    }
+
+    MemoryBlockAccessResult writeBytes(const byte_t *pSrc, uint64_t addr, std::size_t n, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return writeBytes(pSrc, addr, n, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+#if defined(MARTY_MEM_HAS_SPAN)
+
+    MemoryBlockAccessResult readBytes(std::span<byte_t> dst, uint64_t addr, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        return readBytes(dst.data(), addr, dst.size(), memoryOptionFlags, requestedMode);
+    }
+
+    MemoryBlockAccessResult readBytes(std::span<byte_t> dst, uint64_t addr, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        return readBytes(dst.data(), addr, dst.size(), m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    MemoryBlockAccessResult writeBytes(std::span<const byte_t> src, uint64_t addr, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return writeBytes(src.data(), addr, src.size(), memoryOptionFlags, requestedMode);
+    }
+
+    MemoryBlockAccessResult writeBytes(std::span<const byte_t> src, uint64_t addr, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return writeBytes(src.data(), addr, src.size(), m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+#endif
+
+    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, uint64_t nWrite, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
     {
-        memoryOptionFlags &= MemoryOptionFlags::writeSimulate; // Чтобы случайно не просочилось
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
 
         if (nWrite>v.size())
             nWrite = v.size();
 
-        uint64_t addrOrg = addr;
-        for(uint64_t i=0u; i!=nWrite; ++i, ++addr)
+        if (!nWrite)
+            return MemoryAccessResultCode::accessGranted;
+
+        return writeBlockImpl(&v[0], addr, nWrite, memoryOptionFlags, requestedMode, 0);
+    }
+
+    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, uint64_t nWrite, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return write(v, addr, nWrite, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return write(v, addr, v.size(), memoryOptionFlags, requestedMode);
+    }
+
+    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return write(v, addr, v.size(), m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    //! Чтение массива целых. Порядок байт применяется ко всему массиву сразу (SIMD, если доступен)
+    /*! numProcessed в результате - количество полностью прочитанных элементов
+     */
+    template< typename IntType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+    MemoryBlockAccessResult readArray(IntType *pDst, uint64_t addr, std::size_t count, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        MARTY_MEM_ASSERT(pDst || !count);
+
+        if (!checkAddressAligned(addr, sizeof(IntType)) && (memoryOptionFlags&MemoryOptionFlags::restrictUnalignedAccess)!=0)
+            return MemoryBlockAccessResult{MemoryAccessResultCode::unalignedMemoryAccess, 0};
+
+        uint64_t nProcessed = 0;
+        auto rc = readBlockImpl(reinterpret_cast<byte_t*>(pDst), addr, uint64_t(count)*sizeof(IntType), memoryOptionFlags, requestedMode, &nProcessed);
+
+        auto numElements = std::size_t(nProcessed/sizeof(IntType));
+        permuteArrayBytes(reinterpret_cast<byte_t*>(pDst), numElements, sizeof(IntType), getArrayPermutationMask(sizeof(IntType)));
+
+        return MemoryBlockAccessResult{rc, numElements};
+    }
+
+    template< typename IntType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+    MemoryBlockAccessResult readArray(IntType *pDst, uint64_t addr, std::size_t count, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead) const
+    {
+        return readArray(pDst, addr, count, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    //! Запись массива целых. При ошибке ничего не записывается, numProcessed==0
+    template< typename IntType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+    MemoryBlockAccessResult writeArray(const IntType *pSrc, uint64_t addr, std::size_t count, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        MARTY_MEM_ASSERT(pSrc || !count);
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
+
+        if (!checkAddressAligned(addr, sizeof(IntType)) && (memoryOptionFlags&MemoryOptionFlags::restrictUnalignedAccess)!=0)
+            return MemoryBlockAccessResult{MemoryAccessResultCode::unalignedMemoryAccess, 0};
+
+        auto mask   = getArrayPermutationMask(sizeof(IntType));
+        auto nBytes = uint64_t(count)*sizeof(IntType);
+
+        if (!mask) // Порядок байт совпадает с хостом - пишем прямо из исходного массива
         {
-            auto rc = write(v[i], addr, memoryOptionFlags|MemoryOptionFlags::writeSimulate, requestedMode);
-            if (rc!=MemoryAccessResultCode::accessGranted)
-                return rc;
+            auto rc = writeBlockImpl(reinterpret_cast<const byte_t*>(pSrc), addr, nBytes, memoryOptionFlags, requestedMode, 0);
+            return MemoryBlockAccessResult{rc, rc==MemoryAccessResultCode::accessGranted ? count : std::size_t(0)};
         }
 
-        addr = addrOrg;
-        for(uint64_t i=0u; i!=nWrite; ++i, ++addr)
+        // Сначала проверяем весь диапазон, потом пишем через буфер, переставляя байты кусками
+        auto rc = writeBlockImpl(0, addr, nBytes, memoryOptionFlags|MemoryOptionFlags::writeSimulate, requestedMode, 0);
+        if (rc!=MemoryAccessResultCode::accessGranted)
+            return MemoryBlockAccessResult{rc, 0};
+
+        const std::size_t bufElements = 1024u/sizeof(IntType);
+        IntType buf[bufElements];
+
+        for(std::size_t nDone=0; nDone!=count; )
         {
-            write(v[i], addr, memoryOptionFlags, requestedMode);
+            auto n = std::min(bufElements, count-nDone);
+            std::memcpy(&buf[0], pSrc+nDone, n*sizeof(IntType));
+            permuteArrayBytes(reinterpret_cast<byte_t*>(&buf[0]), n, sizeof(IntType), mask);
+            writeBlockImpl(reinterpret_cast<const byte_t*>(&buf[0]), addr, uint64_t(n)*sizeof(IntType), memoryOptionFlags, requestedMode, 0);
+            addr  += uint64_t(n)*sizeof(IntType);
+            nDone += n;
         }
 
-        return MemoryAccessResultCode::accessGranted;
+        return MemoryBlockAccessResult{MemoryAccessResultCode::accessGranted, count};
     }
 
-    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, uint64_t nWrite, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
+    template< typename IntType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+    MemoryBlockAccessResult writeArray(const IntType *pSrc, uint64_t addr, std::size_t count, MemoryAccessRights requestedMode=MemoryAccessRights::write)
     {
-        return write(v, addr, nWrite, m_memoryTraits.memoryOptionFlags, requestedMode);
+        return writeArray(pSrc, addr, count, m_memoryTraits.memoryOptionFlags, requestedMode);
     }
 
-    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
+    //! Заполняет диапазон [addr, addr+size) байтом b. Диапазон, заворачивающийся через конец адресного пространства - memoryFillError
+    MemoryAccessResultCode fill(uint64_t addr, uint64_t size, byte_t b, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
     {
-        return write(v, addr, v.size(), memoryOptionFlags, requestedMode);
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
+        return fillImpl(addr, size, &b, 1u, memoryOptionFlags, requestedMode);
     }
 
-    MemoryAccessResultCode write(const byte_vector_t &v, uint64_t addr, MemoryAccessRights requestedMode=MemoryAccessRights::executeRead)
+    MemoryAccessResultCode fill(uint64_t addr, uint64_t size, byte_t b, MemoryAccessRights requestedMode=MemoryAccessRights::write)
     {
-        return write(v, addr, v.size(), m_memoryTraits.memoryOptionFlags, requestedMode);
+        return fill(addr, size, b, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    //! Заполняет диапазон повторяющимся шаблоном, первый байт шаблона ложится по addr. Пустой шаблон - memoryFillError
+    MemoryAccessResultCode fillPattern(uint64_t addr, uint64_t size, const byte_t *pPattern, std::size_t patternSize, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        memoryOptionFlags &= ~MemoryOptionFlags::writeSimulate; // Флаги вызывающего сохраняем, симуляцию записи извне не пропускаем
+        return fillImpl(addr, size, pPattern, patternSize, memoryOptionFlags, requestedMode);
+    }
+
+    MemoryAccessResultCode fillPattern(uint64_t addr, uint64_t size, const byte_t *pPattern, std::size_t patternSize, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return fillPattern(addr, size, pPattern, patternSize, m_memoryTraits.memoryOptionFlags, requestedMode);
+    }
+
+    MemoryAccessResultCode fillPattern(uint64_t addr, uint64_t size, const byte_vector_t &pattern, MemoryOptionFlags memoryOptionFlags, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return fillPattern(addr, size, pattern.data(), pattern.size(), memoryOptionFlags, requestedMode);
+    }
+
+    MemoryAccessResultCode fillPattern(uint64_t addr, uint64_t size, const byte_vector_t &pattern, MemoryAccessRights requestedMode=MemoryAccessRights::write)
+    {
+        return fillPattern(addr, size, pattern.data(), pattern.size(), m_memoryTraits.memoryOptionFlags, requestedMode);
     }
 
 
@@ -650,7 +2113,7 @@ public:
     uint64_t addressMax() const { return m_addressValidMax; }
     bool     addressMinMaxValid() const { return m_addressValidMin<=m_addressValidMax; }
 
-    bool     empty() const { return m_memMap.empty(); }
+    bool     empty() const { return !addressMinMaxValid(); }
     
     uint64_t addressBegin() const { return m_addressValidMin; }
     uint64_t addressEnd()   const { return empty() ? m_addressValidMin : m_addressValidMax+1; }
@@ -664,46 +2127,118 @@ public:
         return addressBegin()+diff;
     }
 
-    template<typename IntType=byte_t> MemoryIterator<IntType> begin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
-    template<typename IntType=byte_t> MemoryIterator<IntType> end(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
+    //! Обходит участки валидных байт по возрастанию адресов. Handler - void(const MemoryExtent &chunk)
+    /*! Участки ищутся по картам валидности, пословно; страницы берутся из упорядоченного индекса,
+        пропуски между страницами ничего не стоят.
+        Участок не выходит за страницу (в плоском регионе - за регион), его pData всегда задан.
+        Соседние участки могут продолжать друг друга - склеенные участки выдаёт forEachValidExtent.
+        Страницы MMIO не имеют хранилища и не выдаются. Указатели действительны до следующей модификации памяти
+     */
+    template<typename Handler>
+    void forEachValidChunk(Handler h) const
+    {
+        auto chunkHandler = [&](const MemoryExtent &chunk) { h(chunk); return true; };
+        forEachValidChunkImpl(0, ~uint64_t(0), chunkHandler);
+    }
+
+    //! То же для диапазона [addr, addr+size) - за O(log n + k), участки на краях обрезаются по диапазону
+    template<typename Handler>
+    void forEachValidChunk(uint64_t addr, uint64_t size, Handler h) const
+    {
+        if (!size)
+            return;
+
+        auto chunkHandler = [&](const MemoryExtent &chunk) { h(chunk); return true; };
+        forEachValidChunkImpl(addr, calcRangeLast(addr, size), chunkHandler);
+    }
+
+    //! Обходит максимальные участки валидных байт по возрастанию адресов. Handler - void(const MemoryExtent &extent)
+    /*! pData задан, только если участок лежит одним куском (см. MemoryExtent), иначе данные читаются через readBytes
+     */
+    template<typename Handler>
+    void forEachValidExtent(Handler h) const
+    {
+        forEachValidExtentImpl(0, ~uint64_t(0), h);
+    }
+
+    template<typename Handler>
+    void forEachValidExtent(uint64_t addr, uint64_t size, Handler h) const
+    {
+        if (size)
+            forEachValidExtentImpl(addr, calcRangeLast(addr, size), h);
+    }
+
+    //! Максимальные участки валидных байт по возрастанию адресов
+    std::vector<MemoryExtent> getValidExtents() const
+    {
+        std::vector<MemoryExtent> res;
+        forEachValidExtent([&](const MemoryExtent &ext) { res.push_back(ext); });
+        return res;
+    }
+
+    std::vector<MemoryExtent> getValidExtents(uint64_t addr, uint64_t size) const
+    {
+        std::vector<MemoryExtent> res;
+        forEachValidExtent(addr, size, [&](const MemoryExtent &ext) { res.push_back(ext); });
+        return res;
+    }
 
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> begin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> end(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    //! Ближайший записанный адрес, не меньший addr. Если таких нет - возвращаем false
+    bool findNextValidAddress(uint64_t addr, uint64_t *pFoundAddr) const
+    {
+        bool bFound = false;
+        auto chunkHandler = [&](const MemoryExtent &chunk)
+        {
+            if (pFoundAddr)
+                *pFoundAddr = chunk.addr;
+            bFound = true;
+            return false;
+        };
+
+        forEachValidChunkImpl(addr, ~uint64_t(0), chunkHandler);
+        return bFound;
+    }
+
+    template<typename IntType=byte_t> MemoryIterator<IntType, BasicMemory> begin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
+    template<typename IntType=byte_t> MemoryIterator<IntType, BasicMemory> end(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
 
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> cbegin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> cend(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> begin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> end(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
 
-    template<typename IntType=byte_t> MemoryIterator<IntType>      iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
-    template<typename IntType=byte_t> ConstMemoryIterator<IntType> citerator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> cbegin(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> cend(MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
 
+    template<typename IntType=byte_t> MemoryIterator<IntType, BasicMemory>      iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss);
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
+    template<typename IntType=byte_t> ConstMemoryIterator<IntType, BasicMemory> citerator(uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) const;
 
-}; // class Memory
+
+}; // class BasicMemory
 
 //----------------------------------------------------------------------------
 
 
 
 //----------------------------------------------------------------------------
-template<typename IntType>
+template<typename IntType, typename MemoryType>
 struct MemoryIterator : public MemoryIteratorBaseImpl<IntType>
 {
 
     using BaseImpl = MemoryIteratorBaseImpl<IntType>;
 
-    Memory              *pMemory = 0;
+    MemoryType          *pMemory = 0;
     MemoryOptionFlags    memoryOptionFlags = MemoryOptionFlags::none;
 
 
     struct AccessProxy
     {
-        Memory             *pMemory = 0;
+        MemoryType         *pMemory = 0;
         uint64_t            address = 0;
         MemoryOptionFlags   memoryOptionFlags = 0;
 
         AccessProxy() {}
 
-        explicit AccessProxy(Memory *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        explicit AccessProxy(MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
         {
             MARTY_MEM_ASSERT(pMemory);
         }
@@ -728,9 +2263,16 @@ struct MemoryIterator : public MemoryIteratorBaseImpl<IntType>
     }; // struct AccessProxy
 
 
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type        = IntType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = AccessProxy;
+
+
     MemoryIterator() {}
 
-    explicit MemoryIterator(Memory *pm, uint64_t addr, MemoryOptionFlags mof) : BaseImpl(addr), pMemory(pm)
+    explicit MemoryIterator(MemoryType *pm, uint64_t addr, MemoryOptionFlags mof) : BaseImpl(addr), pMemory(pm)
     {
         MARTY_MEM_ASSERT(pMemory);
 
@@ -762,7 +2304,7 @@ struct MemoryIterator : public MemoryIteratorBaseImpl<IntType>
     MemoryIterator& operator+=(ptrdiff_t d)      { BaseImpl::add     (d, getThrowOnWrapOption()); return *this; }
     MemoryIterator& operator-=(ptrdiff_t d)      { BaseImpl::subtract(d, getThrowOnWrapOption()); return *this; }
 
-    AccessProxy operator*()
+    AccessProxy operator*() const
     {
         return AccessProxy(pMemory, BaseImpl::address, memoryOptionFlags);
     }
@@ -770,25 +2312,25 @@ struct MemoryIterator : public MemoryIteratorBaseImpl<IntType>
 }; // struct MemoryIterator
 
 
-template<typename IntType> MemoryIterator<IntType> operator+(MemoryIterator<IntType> it, ptrdiff_t d) { it += d; return it; }
-template<typename IntType> MemoryIterator<IntType> operator+(ptrdiff_t d, MemoryIterator<IntType> it) { it += d; return it; }
-template<typename IntType> MemoryIterator<IntType> operator-(MemoryIterator<IntType> it, ptrdiff_t d) { it -= d; return it; }
+template<typename IntType, typename MemoryType> MemoryIterator<IntType, MemoryType> operator+(MemoryIterator<IntType, MemoryType> it, ptrdiff_t d) { it += d; return it; }
+template<typename IntType, typename MemoryType> MemoryIterator<IntType, MemoryType> operator+(ptrdiff_t d, MemoryIterator<IntType, MemoryType> it) { it += d; return it; }
+template<typename IntType, typename MemoryType> MemoryIterator<IntType, MemoryType> operator-(MemoryIterator<IntType, MemoryType> it, ptrdiff_t d) { it -= d; return it; }
 
-template<typename IntType> ptrdiff_t operator-(MemoryIterator<IntType> it1, MemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> ptrdiff_t operator-(MemoryIterator<IntType, MemoryType> it1, MemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't calculate MemoryIterator difference: difference of iterators is not equal to size of type");
     return ptrdiff_t(delta/sizeof(IntType));
 }
 
-template<typename IntType> bool operator==(MemoryIterator<IntType> it1, MemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> bool operator==(MemoryIterator<IntType, MemoryType> it1, MemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't compare MemoryIterator's: difference of iterators is not equal to size of type");
     return it1.address==it2.address;
 }
 
-template<typename IntType> bool operator!=(MemoryIterator<IntType> it1, MemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> bool operator!=(MemoryIterator<IntType, MemoryType> it1, MemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't compare MemoryIterator's: difference of iterators is not equal to size of type");
@@ -800,25 +2342,25 @@ template<typename IntType> bool operator!=(MemoryIterator<IntType> it1, MemoryIt
 
 
 //----------------------------------------------------------------------------
-template<typename IntType>
+template<typename IntType, typename MemoryType>
 struct ConstMemoryIterator : public MemoryIteratorBaseImpl<IntType>
 {
 
     using BaseImpl = MemoryIteratorBaseImpl<IntType>;
 
-    const Memory        *pMemory = 0;
+    const MemoryType    *pMemory = 0;
     MemoryOptionFlags    memoryOptionFlags = MemoryOptionFlags::none;
 
 
     struct AccessProxy
     {
-        const Memory       *pMemory = 0;
+        const MemoryType   *pMemory = 0;
         uint64_t            address = 0;
         MemoryOptionFlags   memoryOptionFlags = 0; // bool throwOnHitMiss
 
         AccessProxy() {}
 
-        explicit AccessProxy(const Memory *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        explicit AccessProxy(const MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
         {
             MARTY_MEM_ASSERT(pMemory);
         }
@@ -835,9 +2377,16 @@ struct ConstMemoryIterator : public MemoryIteratorBaseImpl<IntType>
     }; // struct AccessProxy
 
 
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type        = IntType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = AccessProxy;
+
+
     ConstMemoryIterator() {}
 
-    explicit ConstMemoryIterator(const Memory *pm, uint64_t addr, MemoryOptionFlags mof) : BaseImpl(addr), pMemory(pm)
+    explicit ConstMemoryIterator(const MemoryType *pm, uint64_t addr, MemoryOptionFlags mof) : BaseImpl(addr), pMemory(pm)
     {
         MARTY_MEM_ASSERT(pMemory);
      
@@ -847,7 +2396,7 @@ struct ConstMemoryIterator : public MemoryIteratorBaseImpl<IntType>
         memoryOptionFlags |= mof;
     }
 
-    ConstMemoryIterator(MemoryIterator<IntType> it) : BaseImpl(it.address), pMemory(it.pMemory), memoryOptionFlags(it.memoryOptionFlags) {}
+    ConstMemoryIterator(MemoryIterator<IntType, MemoryType> it) : BaseImpl(it.address), pMemory(it.pMemory), memoryOptionFlags(it.memoryOptionFlags) {}
     
     // Остальные ctor/op= компилятор сам сгенерит
 
@@ -871,7 +2420,7 @@ struct ConstMemoryIterator : public MemoryIteratorBaseImpl<IntType>
     ConstMemoryIterator& operator+=(ptrdiff_t d)      { BaseImpl::add     (d, getThrowOnWrapOption()); return *this; }
     ConstMemoryIterator& operator-=(ptrdiff_t d)      { BaseImpl::subtract(d, getThrowOnWrapOption()); return *this; }
 
-    AccessProxy operator*()
+    AccessProxy operator*() const
     {
         return AccessProxy(pMemory, BaseImpl::address, memoryOptionFlags);
     }
@@ -879,25 +2428,25 @@ struct ConstMemoryIterator : public MemoryIteratorBaseImpl<IntType>
 }; // struct ConstMemoryIterator
 
 
-template<typename IntType> ConstMemoryIterator<IntType> operator+(ConstMemoryIterator<IntType> it, ptrdiff_t d) { it += d; return it; }
-template<typename IntType> ConstMemoryIterator<IntType> operator+(ptrdiff_t d, ConstMemoryIterator<IntType> it) { it += d; return it; }
-template<typename IntType> ConstMemoryIterator<IntType> operator-(ConstMemoryIterator<IntType> it, ptrdiff_t d) { it -= d; return it; }
+template<typename IntType, typename MemoryType> ConstMemoryIterator<IntType, MemoryType> operator+(ConstMemoryIterator<IntType, MemoryType> it, ptrdiff_t d) { it += d; return it; }
+template<typename IntType, typename MemoryType> ConstMemoryIterator<IntType, MemoryType> operator+(ptrdiff_t d, ConstMemoryIterator<IntType, MemoryType> it) { it += d; return it; }
+template<typename IntType, typename MemoryType> ConstMemoryIterator<IntType, MemoryType> operator-(ConstMemoryIterator<IntType, MemoryType> it, ptrdiff_t d) { it -= d; return it; }
 
-template<typename IntType> ptrdiff_t operator-(ConstMemoryIterator<IntType> it1, ConstMemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> ptrdiff_t operator-(ConstMemoryIterator<IntType, MemoryType> it1, ConstMemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't calculate ConstMemoryIterator difference: difference of iterators is not equal to size of type");
     return ptrdiff_t(delta/sizeof(IntType));
 }
 
-template<typename IntType> bool operator==(ConstMemoryIterator<IntType> it1, ConstMemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> bool operator==(ConstMemoryIterator<IntType, MemoryType> it1, ConstMemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't compare ConstMemoryIterator's: difference of iterators is not equal to size of type");
     return it1.address==it2.address;
 }
 
-template<typename IntType> bool operator!=(ConstMemoryIterator<IntType> it1, ConstMemoryIterator<IntType> it2)
+template<typename IntType, typename MemoryType> bool operator!=(ConstMemoryIterator<IntType, MemoryType> it1, ConstMemoryIterator<IntType, MemoryType> it2)
 {
     uint64_t delta = it1.address - it2.address;
     it1.checkDiff(delta, "can't compare ConstMemoryIterator's: difference of iterators is not equal to size of type");
@@ -909,18 +2458,124 @@ template<typename IntType> bool operator!=(ConstMemoryIterator<IntType> it1, Con
 
 
 //----------------------------------------------------------------------------
-template<typename IntType> MemoryIterator<IntType>      Memory::begin(MemoryOptionFlags memoryOptionFlags)        { return MemoryIterator<IntType>(this, addressBegin(), memoryOptionFlags); }
-template<typename IntType> MemoryIterator<IntType>      Memory::end(MemoryOptionFlags memoryOptionFlags)          { return MemoryIterator<IntType>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
+/*
+    Блочное копирование между итераторами памяти и буферами хоста. Вызов copy(first, last, out) без квалификации
+    находит эти перегрузки через ADL (они точнее std::copy), вместо поэлементного чтения/записи через AccessProxy
+    выполняется readArray/writeArray. Ошибки доступа, как и у поэлементного доступа, кидают исключение
+    (уже скопированная часть остаётся скопированной). Буфер хоста - указатель (для вектора - v.data())
+
+    ВАЖНО: блочное копирование работает только при вызове copy без квалификации (using std::copy не мешает - ADL
+    добавит наши перегрузки) или как marty::mem::copy. Квалифицированный std::copy(first, last, out) ищет только
+    в std и эти перегрузки не видит - он пойдёт поэлементно через AccessProxy, по обращению на элемент.
+    Специализировать или перегружать std::copy стандарт не разрешает, поэтому сделать иначе нельзя.
+
+        copy(it, itEnd, v.data());               // блоками
+        marty::mem::copy(it, itEnd, v.data());   // блоками
+        std::copy(it, itEnd, v.data());          // поэлементно
+*/
+
+namespace details
+{
+
+template<typename IntType, typename MemoryType>
+IntType* copyFromMemory(const MemoryType *pMemory, uint64_t addr, ptrdiff_t count, MemoryOptionFlags memoryOptionFlags, IntType *pDst)
+{
+    if (count<=0)
+        return pDst;
+
+    MARTY_MEM_ASSERT(pMemory);
+    auto res = pMemory->readArray(pDst, addr, std::size_t(count), memoryOptionFlags);
+    throwMemoryAccessError(res.resultCode);
+    return pDst+count;
+}
+
+template<typename IntType, typename MemoryType>
+void copyToMemory(const IntType *pSrc, ptrdiff_t count, MemoryType *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags)
+{
+    if (count<=0)
+        return;
+
+    MARTY_MEM_ASSERT(pMemory);
+    auto res = pMemory->writeArray(pSrc, addr, std::size_t(count), memoryOptionFlags);
+    throwMemoryAccessError(res.resultCode);
+}
+
+template<typename IntType, typename SrcMemoryType, typename DstMemoryType>
+void copyMemoryToMemory(const SrcMemoryType *pSrcMemory, uint64_t srcAddr, ptrdiff_t count, MemoryOptionFlags srcOptionFlags, DstMemoryType *pDstMemory, uint64_t dstAddr, MemoryOptionFlags dstOptionFlags)
+{
+    // Копируем вперёд кусками через буфер, как и std::copy - dst не должен начинаться внутри [src, src+count)
+    const std::size_t bufElements = 1024u/sizeof(IntType);
+    IntType buf[bufElements];
+
+    while(count>0)
+    {
+        auto n = std::min(bufElements, std::size_t(count));
+        copyFromMemory(pSrcMemory, srcAddr, ptrdiff_t(n), srcOptionFlags, &buf[0]);
+        copyToMemory(&buf[0], ptrdiff_t(n), pDstMemory, dstAddr, dstOptionFlags);
+        srcAddr += uint64_t(n)*sizeof(IntType);
+        dstAddr += uint64_t(n)*sizeof(IntType);
+        count   -= ptrdiff_t(n);
+    }
+}
+
+} // namespace details
+
+template< typename IntType, typename MemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+IntType* copy(ConstMemoryIterator<IntType, MemoryType> first, ConstMemoryIterator<IntType, MemoryType> last, IntType *pDst)
+{
+    return details::copyFromMemory(first.pMemory, first.address, last-first, first.memoryOptionFlags, pDst);
+}
+
+template< typename IntType, typename MemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+IntType* copy(MemoryIterator<IntType, MemoryType> first, MemoryIterator<IntType, MemoryType> last, IntType *pDst)
+{
+    return details::copyFromMemory(static_cast<const MemoryType*>(first.pMemory), first.address, last-first, first.memoryOptionFlags, pDst);
+}
+
+template< typename IntType, typename MemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+MemoryIterator<IntType, MemoryType> copy(const IntType *first, const IntType *last, MemoryIterator<IntType, MemoryType> out)
+{
+    details::copyToMemory(first, last-first, out.pMemory, out.address, out.memoryOptionFlags);
+    return last-first>0 ? out+(last-first) : out;
+}
+
+template< typename IntType, typename MemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+MemoryIterator<IntType, MemoryType> copy(IntType *first, IntType *last, MemoryIterator<IntType, MemoryType> out)
+{
+    return copy(static_cast<const IntType*>(first), static_cast<const IntType*>(last), out);
+}
+
+template< typename IntType, typename SrcMemoryType, typename DstMemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+MemoryIterator<IntType, DstMemoryType> copy(ConstMemoryIterator<IntType, SrcMemoryType> first, ConstMemoryIterator<IntType, SrcMemoryType> last, MemoryIterator<IntType, DstMemoryType> out)
+{
+    auto count = last-first;
+    details::copyMemoryToMemory<IntType>(first.pMemory, first.address, count, first.memoryOptionFlags, out.pMemory, out.address, out.memoryOptionFlags);
+    return count>0 ? out+count : out;
+}
+
+template< typename IntType, typename SrcMemoryType, typename DstMemoryType, typename std::enable_if< std::is_integral< IntType >::value, bool>::type = true >
+MemoryIterator<IntType, DstMemoryType> copy(MemoryIterator<IntType, SrcMemoryType> first, MemoryIterator<IntType, SrcMemoryType> last, MemoryIterator<IntType, DstMemoryType> out)
+{
+    return copy(ConstMemoryIterator<IntType, SrcMemoryType>(first), ConstMemoryIterator<IntType, SrcMemoryType>(last), out);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> MemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> >      BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::begin(MemoryOptionFlags memoryOptionFlags)        { return MemoryIterator<IntType, BasicMemory>(this, addressBegin(), memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> MemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> >      BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::end(MemoryOptionFlags memoryOptionFlags)          { return MemoryIterator<IntType, BasicMemory>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
  
-template<typename IntType> ConstMemoryIterator<IntType> Memory::begin(MemoryOptionFlags memoryOptionFlags)  const { return ConstMemoryIterator<IntType>(this, addressBegin(), memoryOptionFlags); }
-template<typename IntType> ConstMemoryIterator<IntType> Memory::end(MemoryOptionFlags memoryOptionFlags)    const { return ConstMemoryIterator<IntType>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::begin(MemoryOptionFlags memoryOptionFlags)  const { return ConstMemoryIterator<IntType, BasicMemory>(this, addressBegin(), memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::end(MemoryOptionFlags memoryOptionFlags)    const { return ConstMemoryIterator<IntType, BasicMemory>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
  
-template<typename IntType> ConstMemoryIterator<IntType> Memory::cbegin(MemoryOptionFlags memoryOptionFlags) const { return ConstMemoryIterator<IntType>(this, addressBegin(), memoryOptionFlags); }
-template<typename IntType> ConstMemoryIterator<IntType> Memory::cend(MemoryOptionFlags memoryOptionFlags)   const { return ConstMemoryIterator<IntType>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::cbegin(MemoryOptionFlags memoryOptionFlags) const { return ConstMemoryIterator<IntType, BasicMemory>(this, addressBegin(), memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::cend(MemoryOptionFlags memoryOptionFlags)   const { return ConstMemoryIterator<IntType, BasicMemory>(this, addressEndAligned<IntType>(), memoryOptionFlags); }
 
-template<typename IntType> MemoryIterator<IntType>      Memory::iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags)        { return MemoryIterator<IntType>(this, addr, memoryOptionFlags); }
-template<typename IntType> ConstMemoryIterator<IntType> Memory::iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags)  const { return ConstMemoryIterator<IntType>(this, addr, memoryOptionFlags); }
-template<typename IntType> ConstMemoryIterator<IntType> Memory::citerator(uint64_t addr, MemoryOptionFlags memoryOptionFlags) const { return ConstMemoryIterator<IntType>(this, addr, memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> MemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> >      BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags)        { return MemoryIterator<IntType, BasicMemory>(this, addr, memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::iterator(uint64_t addr, MemoryOptionFlags memoryOptionFlags)  const { return ConstMemoryIterator<IntType, BasicMemory>(this, addr, memoryOptionFlags); }
+template<int PageBits, typename EndiannessPolicy, typename AccessPolicy, typename DefaultValuePolicy> template<typename IntType> ConstMemoryIterator<IntType, BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy> > BasicMemory<PageBits, EndiannessPolicy, AccessPolicy, DefaultValuePolicy>::citerator(uint64_t addr, MemoryOptionFlags memoryOptionFlags) const { return ConstMemoryIterator<IntType, BasicMemory>(this, addr, memoryOptionFlags); }
 
 
 // MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss
@@ -0,0 +1,311 @@
+/*! \file
+    \brief Страница памяти с битовой картой валидности
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Размер страницы задаётся на этапе компиляции - 2^PageBits байт.
+    Каждому байту соответствует бит валидности (единичный бит - байт ранее
+    был записан). Младшие биты соответствуют младшим адресам.
+
+    Для страниц до 64 байт карта валидности - одно слово подходящего размера
+    (для 16-байтного параграфа - uint16_t, как и было), для страниц больше
+    - массив uint64_t.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "bits.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/mem_page.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+namespace details
+{
+
+template<int PageBits> struct MemPageValidWord    { using type = uint64_t; };
+template<>             struct MemPageValidWord<3> { using type = uint8_t ; };
+template<>             struct MemPageValidWord<4> { using type = uint16_t; };
+template<>             struct MemPageValidWord<5> { using type = uint32_t; };
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<int PageBits>
+struct MemPage
+{
+    // Минимум - 8 байт, чтобы выровненное значение максимального размера всегда помещалось в страницу
+    static_assert(PageBits>=3 && PageBits<=24, "MemPage: PageBits must be in range 3..24");
+
+    using valid_word_t = typename details::MemPageValidWord<PageBits>::type;
+
+    static constexpr const int         pageBits      = PageBits;
+    static constexpr const std::size_t pageSize      = std::size_t(1)<<PageBits;
+    static constexpr const uint64_t    pageMask      = uint64_t(pageSize-1u);
+    static constexpr const std::size_t validWordBits = sizeof(valid_word_t)*8u;
+    static constexpr const std::size_t numValidWords = pageSize/validWordBits;
+
+    valid_word_t   validBits[numValidWords] = {}; // единичный бит говорит, что память была ранее присвоена, 0 - память неинициализирована
+    byte_t         bytes[pageSize];
+
+
+    MemPage()
+    {
+        std::memset(&bytes[0], 0, pageSize);
+    }
+
+    explicit MemPage(byte_t fill)
+    {
+        std::memset(&bytes[0], fill, pageSize);
+    }
+
+    // Выровненное значение размером size (1/2/4/8) по смещению offs в странице всегда лежит в одном слове карты валидности
+    static constexpr
+    std::size_t getValidWordIndex(std::size_t offs)
+    {
+        return offs/validWordBits;
+    }
+
+    static constexpr
+    valid_word_t getAlignedValueValidBits(std::size_t offs, std::size_t size)
+    {
+        return valid_word_t(((uint64_t(1)<<size)-1u) << (offs%validWordBits));
+    }
+
+    static
+    bool checkAlignedValueValid(const valid_word_t *pValidBits, std::size_t offs, std::size_t size)
+    {
+        auto mask = getAlignedValueValidBits(offs, size);
+        return (pValidBits[getValidWordIndex(offs)]&mask)==mask;
+    }
+
+    static
+    void setAlignedValueValid(valid_word_t *pValidBits, std::size_t offs, std::size_t size)
+    {
+        pValidBits[getValidWordIndex(offs)] |= getAlignedValueValidBits(offs, size);
+    }
+
+    //! Маска бит валидности для n байт (1..validWordBits) начиная с бита bit слова
+    static constexpr
+    valid_word_t getWordRangeValidBits(std::size_t bit, std::size_t n)
+    {
+        return n==validWordBits ? valid_word_t(~valid_word_t(0)) : valid_word_t(((uint64_t(1)<<n)-1u) << bit);
+    }
+
+    //! Проверка валидности произвольного диапазона байт, пословно
+    static
+    bool checkRangeValid(const valid_word_t *pValidBits, std::size_t offs, std::size_t size)
+    {
+        while(size)
+        {
+            auto bit  = offs%validWordBits;
+            auto n    = std::min(size, validWordBits-bit);
+            auto mask = getWordRangeValidBits(bit, n);
+            if ((pValidBits[offs/validWordBits]&mask)!=mask)
+                return false;
+            offs += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    static
+    void setRangeValid(valid_word_t *pValidBits, std::size_t offs, std::size_t size)
+    {
+        while(size)
+        {
+            auto bit  = offs%validWordBits;
+            auto n    = std::min(size, validWordBits-bit);
+            pValidBits[offs/validWordBits] |= getWordRangeValidBits(bit, n);
+            offs += n;
+            size -= n;
+        }
+    }
+
+    //! Обходит участки подряд идущих валидных байт в диапазоне [offs, offs+size) карты валидности
+    /*! Handler - bool(std::size_t runOffs, std::size_t runLen), false - прекратить обход (тогда возвращаем false).
+        Участки, продолжающиеся через границу слова, склеиваются, участки на краях диапазона обрезаются по нему.
+        Слова просматриваются целиком, без побитового перебора
+     */
+    template<typename Handler>
+    static
+    bool forEachValidRun(const valid_word_t *pValidBits, std::size_t offs, std::size_t size, Handler h)
+    {
+        const uint64_t fullWord = validWordBits==64u ? ~uint64_t(0) : (uint64_t(1)<<validWordBits)-1u;
+        const std::size_t end   = offs+size;
+
+        bool        inRun    = false;
+        std::size_t runStart = 0;
+
+        pValidBits += offs/validWordBits;
+        for(std::size_t wordBase=offs-offs%validWordBits; wordBase<end; wordBase+=validWordBits, ++pValidBits)
+        {
+            uint64_t word = uint64_t(*pValidBits);
+            if (wordBase<offs) // Биты до начала диапазона
+                word &= (fullWord<<(offs-wordBase))&fullWord;
+            if (end-wordBase<validWordBits) // Биты после конца диапазона
+                word &= (uint64_t(1)<<(end-wordBase))-1u;
+
+            if (word==(inRun ? fullWord : 0u)) // Слово целиком продолжает текущее состояние
+                continue;
+
+            for(std::size_t pos=0; pos<validWordBits; )
+            {
+                uint64_t rest = (inRun ? ~word&fullWord : word) >> pos; // Ищем конец участка или начало следующего
+                if (!rest)
+                    break;
+
+                pos += std::size_t(bits::countTrailingZeros(rest));
+                if (inRun)
+                {
+                    if (!h(runStart, wordBase+pos-runStart))
+                        return false;
+                }
+                else
+                {
+                    runStart = wordBase+pos;
+                }
+                inRun = !inRun;
+            }
+        }
+
+        if (inRun)
+            return h(runStart, end-runStart);
+
+        return true;
+    }
+
+    bool checkAlignedValueValid(std::size_t offs, std::size_t size) const
+    {
+        return checkAlignedValueValid(&validBits[0], offs, size);
+    }
+
+    void setAlignedValueValid(std::size_t offs, std::size_t size)
+    {
+        setAlignedValueValid(&validBits[0], offs, size);
+    }
+
+}; // struct MemPage
+
+//----------------------------------------------------------------------------
+//! Страница со счётчиком ссылок - для разделения страниц между снимками памяти (copy-on-write)
+template<int PageBits>
+struct SharedMemPage : public MemPage<PageBits>
+{
+    using page_type = MemPage<PageBits>;
+
+    mutable std::atomic<uint32_t>   refCount;
+
+
+    explicit SharedMemPage(byte_t fill) : page_type(fill), refCount(1u) {}
+
+    SharedMemPage(const SharedMemPage &other) : page_type(other), refCount(1u) {}
+
+    SharedMemPage& operator=(const SharedMemPage &) = delete;
+
+    bool isShared() const
+    {
+        return refCount.load(std::memory_order_acquire)>1u;
+    }
+
+    void addRef() const
+    {
+        refCount.fetch_add(1u, std::memory_order_relaxed);
+    }
+
+    //! Возвращает true, если ссылка была последней и страницу надо удалить
+    bool release() const
+    {
+        return refCount.fetch_sub(1u, std::memory_order_acq_rel)==1u;
+    }
+
+}; // struct SharedMemPage
+
+//----------------------------------------------------------------------------
+//! Ссылка на данные страницы - отдельной MemPage или куска плоского региона (там байты и карта валидности лежат в разных массивах)
+template<int PageBits>
+struct MemPageRef
+{
+    using page_type    = MemPage<PageBits>;
+    using valid_word_t = typename page_type::valid_word_t;
+
+    byte_t         *bytes     = 0;
+    valid_word_t   *validBits = 0;
+    uint32_t        hookFlags = 0; // Флаги обработчиков страницы (см. MemoryPageHooks), 0 - обычная страница
+    uint32_t        hookIndex = 0; // Номер диапазона MMIO
+
+
+    MemPageRef() {}
+
+    MemPageRef(byte_t *pBytes, valid_word_t *pValidBits) : bytes(pBytes), validBits(pValidBits) {}
+
+    explicit MemPageRef(page_type *pPage)
+    : bytes    (pPage ? &pPage->bytes[0]     : (byte_t*)0)
+    , validBits(pPage ? &pPage->validBits[0] : (valid_word_t*)0)
+    {}
+
+    explicit operator bool() const { return bytes!=0; }
+
+    bool checkAlignedValueValid(std::size_t offs, std::size_t size) const
+    {
+        return page_type::checkAlignedValueValid(validBits, offs, size);
+    }
+
+    void setAlignedValueValid(std::size_t offs, std::size_t size) const
+    {
+        page_type::setAlignedValueValid(validBits, offs, size);
+    }
+
+    bool checkRangeValid(std::size_t offs, std::size_t size) const
+    {
+        return page_type::checkRangeValid(validBits, offs, size);
+    }
+
+    void setRangeValid(std::size_t offs, std::size_t size) const
+    {
+        page_type::setRangeValid(validBits, offs, size);
+    }
+
+}; // struct MemPageRef
+
+//----------------------------------------------------------------------------
+//! Параграф - страница размером 16 байт, исторический формат хранения Memory
+using MemPara = MemPage<4>;
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/mem_page.h"
+
@@ -0,0 +1,128 @@
+/*! \file
+    \brief Программный TLB - кеш поиска страниц
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Прямо отображаемый (direct-mapped) кеш: номер страницы (адрес>>PageBits)
+    по модулю числа записей даёт индекс записи, в записи лежит адрес страницы
+    (тег) и ссылка на её данные. Попадание - одно сравнение тега.
+
+    Адрес страницы всегда выравнен, поэтому в качестве "пустого" тега
+    используется заведомо невыравненное значение.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "fixed_size_types.h"
+#include "mem_page.h"
+
+//----------------------------------------------------------------------------
+#include <cstddef>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/mem_tlb.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+struct MemoryTlbStats
+{
+    uint64_t    readHits    = 0;
+    uint64_t    readMisses  = 0;
+    uint64_t    writeHits   = 0;
+    uint64_t    writeMisses = 0;
+
+}; // struct MemoryTlbStats
+
+//----------------------------------------------------------------------------
+template<int PageBits, std::size_t NumEntries=64>
+class MemPageTlb
+{
+
+public:
+
+    using page_ref_type = MemPageRef<PageBits>;
+
+    static constexpr const std::size_t numEntries = NumEntries;
+    static constexpr const uint64_t    invalidTag = 1u;
+
+    static_assert(NumEntries!=0 && (NumEntries&(NumEntries-1u))==0, "MemPageTlb: NumEntries must be a power of 2");
+
+
+protected:
+
+    struct Entry
+    {
+        uint64_t        tag = invalidTag;
+        page_ref_type   page;
+    };
+
+    Entry    m_entries[NumEntries];
+
+    static
+    std::size_t calcIndex(uint64_t pageAddr)
+    {
+        return std::size_t((pageAddr>>PageBits)&(NumEntries-1u));
+    }
+
+
+public:
+
+    //! Возвращает false при промахе. Попадание определяется по тегу - у страниц MMIO ссылка без данных (bytes==0)
+    bool find(uint64_t pageAddr, page_ref_type &page) const
+    {
+        const Entry &e = m_entries[calcIndex(pageAddr)];
+        if (e.tag!=pageAddr)
+            return false;
+        page = e.page;
+        return true;
+    }
+
+    //! Страницы MMIO не имеют данных, но тоже кешируются - вместе с флагами и номером обработчика
+    void insert(uint64_t pageAddr, const page_ref_type &page)
+    {
+        MARTY_MEM_ASSERT(page || page.hookFlags!=0);
+        Entry &e = m_entries[calcIndex(pageAddr)];
+        e.tag  = pageAddr;
+        e.page = page;
+    }
+
+    //! Сбрасывает запись для страницы, если она в TLB
+    void invalidate(uint64_t pageAddr)
+    {
+        Entry &e = m_entries[calcIndex(pageAddr)];
+        if (e.tag==pageAddr)
+            e = Entry();
+    }
+
+    void flush()
+    {
+        for(auto &e : m_entries)
+            e = Entry();
+    }
+
+}; // class MemPageTlb
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/mem_tlb.h"
+
@@ -0,0 +1,382 @@
+/*! \file
+    \brief Страницы с обработчиками - MMIO, точки наблюдения, страницы кода
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Для страницы, на которую назначен обработчик, хранятся флаги (MemoryPageHooks::PageInfo).
+    Флаги попадают в MemPageRef::hookFlags при поиске страницы и кешируются в TLB вместе
+    с ней, поэтому обычный доступ к памяти платит за поддержку обработчиков только
+    проверкой hookFlags у найденной страницы.
+
+    MMIO - диапазоны адресов (выравненные на размер страницы), обращения к которым
+    уходят в обработчики чтения/записи, минуя хранилище страниц. Номер диапазона
+    хранится в MemPageRef::hookIndex, так что вызов обработчика - O(1).
+
+    Значение, передаваемое обработчикам, собрано так же, как в памяти: байт по адресу
+    addr - младший (как у getDefaultValue), перестановку байт делает BasicMemory.
+
+    Точки наблюдения (watchpoints) - на чтение, запись и исполнение. Страницы, которые они
+    задевают, помечаются флагами watchRead/watchWrite/watchExecute, и список точек
+    просматривается только при обращении к помеченной странице. Вид обращения определяется
+    по запрошенным правам: есть бит write - запись, ровно execute - исполнение (выборка
+    инструкций), иначе - чтение (executeRead по умолчанию - это чтение).
+    Срабатывание передаётся обработчику, а если он не задан - запоминается в списке.
+
+    Страницы кода - для кешей декодированных инструкций (JIT и тп). Эмулятор помечает
+    страницы, из которых декодировал код (флаг code); при первой записи в такую страницу
+    отметка снимается и вызывается обработчик с адресом страницы - по нему кеш сбрасывает
+    блоки только этой страницы и при следующем декодировании помечает её снова.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "enums.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/page_hooks.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+//! Чтение регистра устройства. size - от 1 до 8 байт
+using MmioReadHandler  = std::function<MemoryAccessResultCode(uint64_t addr, uint64_t size, uint64_t *pVal)>;
+
+//! Запись регистра устройства. size - от 1 до 8 байт
+using MmioWriteHandler = std::function<MemoryAccessResultCode(uint64_t addr, uint64_t size, uint64_t val)>;
+
+//----------------------------------------------------------------------------
+struct WatchpointHit
+{
+    uint64_t              addr = 0;  // Адрес обращения
+    uint64_t              size = 0;  // Размер обращения
+    MemoryAccessRights    kind = MemoryAccessRights::read; // read, write или execute
+    uint64_t              watchAddr = 0; // Адрес сработавшей точки наблюдения
+
+}; // struct WatchpointHit
+
+using WatchpointHandler = std::function<void(const WatchpointHit &hit)>;
+
+//! Вызывается при первой записи в помеченную страницу кода, отметка к этому моменту уже снята
+using CodePageWriteHandler = std::function<void(uint64_t pageAddr)>;
+
+//----------------------------------------------------------------------------
+struct Watchpoint
+{
+    uint64_t              addr = 0;
+    uint64_t              size = 0;
+    MemoryAccessRights    kind = MemoryAccessRights::write; // Комбинация read/write/execute
+
+    bool intersects(uint64_t a, uint64_t sz) const
+    {
+        return a<=addr+(size-1u) && addr<=a+(sz-1u);
+    }
+
+}; // struct Watchpoint
+
+//----------------------------------------------------------------------------
+struct MmioRange
+{
+    uint64_t            base = 0;
+    uint64_t            size = 0;
+    MmioReadHandler     readHandler ; // Нет обработчика - accessDenied
+    MmioWriteHandler    writeHandler;
+
+    bool intersects(uint64_t b, uint64_t sz) const
+    {
+        return b<base+size && base<b+sz;
+    }
+
+}; // struct MmioRange
+
+//----------------------------------------------------------------------------
+template<int PageBits>
+class MemoryPageHooks
+{
+
+public:
+
+    static constexpr const uint64_t    pageSize = uint64_t(1)<<PageBits;
+    static constexpr const uint64_t    pageMask = pageSize-1u;
+
+    // Флаги страницы
+    static constexpr const uint32_t    mmio         = 0x0001u;
+    static constexpr const uint32_t    watchRead    = 0x0002u;
+    static constexpr const uint32_t    watchWrite   = 0x0004u;
+    static constexpr const uint32_t    watchExecute = 0x0008u;
+    static constexpr const uint32_t    watchMask    = watchRead|watchWrite|watchExecute;
+    static constexpr const uint32_t    code         = 0x0010u;
+
+    struct PageInfo
+    {
+        uint32_t    flags     = 0;
+        uint32_t    mmioIndex = 0;
+    };
+
+
+protected:
+
+    std::unordered_map<uint64_t, PageInfo>    m_pages; // Ключ - адрес страницы
+    std::vector<MmioRange>                    m_mmioRanges;
+    std::vector<Watchpoint>                   m_watchpoints;
+    WatchpointHandler                         m_watchpointHandler;
+    mutable std::vector<WatchpointHit>        m_watchpointHits; // Если обработчик не задан
+    CodePageWriteHandler                      m_codePageWriteHandler;
+
+
+    static
+    uint32_t getWatchFlags(MemoryAccessRights kind)
+    {
+        return ((kind&MemoryAccessRights::read   )!=0 ? watchRead    : 0u)
+             | ((kind&MemoryAccessRights::write  )!=0 ? watchWrite   : 0u)
+             | ((kind&MemoryAccessRights::execute)!=0 ? watchExecute : 0u);
+    }
+
+    template<typename Handler>
+    static
+    void forEachPage(uint64_t addr, uint64_t size, Handler h)
+    {
+        uint64_t lastPage = (addr+(size-1u))&~pageMask;
+        for(uint64_t pageAddr=addr&~pageMask; ; pageAddr+=pageSize)
+        {
+            h(pageAddr);
+            if (pageAddr==lastPage)
+                break;
+        }
+    }
+
+    // Пересчитывает флаги наблюдения для страниц диапазона
+    void updateWatchFlags(uint64_t addr, uint64_t size)
+    {
+        forEachPage(addr, size, [&](uint64_t pageAddr)
+        {
+            uint32_t flags = 0;
+            for(const auto &wp : m_watchpoints)
+            {
+                if (wp.intersects(pageAddr, pageSize))
+                    flags |= getWatchFlags(wp.kind);
+            }
+
+            auto it = m_pages.find(pageAddr);
+            if (it==m_pages.end())
+            {
+                if (flags)
+                    m_pages[pageAddr].flags = flags;
+                return;
+            }
+
+            it->second.flags = (it->second.flags&~watchMask) | flags;
+            if (!it->second.flags)
+                m_pages.erase(it);
+        });
+    }
+
+
+public:
+
+    bool empty() const { return m_pages.empty(); }
+
+    //! Флаги страницы (0, если обработчиков нет). В pIndex возвращается номер диапазона MMIO
+    uint32_t findPageFlags(uint64_t pageAddr, uint32_t *pIndex) const
+    {
+        if (m_pages.empty())
+            return 0;
+
+        auto it = m_pages.find(pageAddr);
+        if (it==m_pages.end())
+            return 0;
+
+        *pIndex = it->second.mmioIndex;
+        return it->second.flags;
+    }
+
+    const std::vector<MmioRange>& getMmioRanges() const { return m_mmioRanges; }
+
+    const MmioRange& getMmioRange(uint32_t idx) const
+    {
+        MARTY_MEM_ASSERT(idx<m_mmioRanges.size());
+        return m_mmioRanges[idx];
+    }
+
+    bool intersectsMmio(uint64_t base, uint64_t size) const
+    {
+        for(const auto &r : m_mmioRanges)
+        {
+            if (r.intersects(base, size))
+                return true;
+        }
+
+        return false;
+    }
+
+    //! base и size должны быть выравнены на размер страницы и не пересекаться с другими диапазонами MMIO (проверяет вызывающий)
+    void addMmioRange(uint64_t base, uint64_t size, MmioReadHandler readHandler, MmioWriteHandler writeHandler)
+    {
+        MARTY_MEM_ASSERT((base&pageMask)==0 && (size&pageMask)==0 && size!=0);
+
+        auto idx = uint32_t(m_mmioRanges.size());
+        m_mmioRanges.emplace_back(MmioRange{base, size, std::move(readHandler), std::move(writeHandler)});
+
+        for(uint64_t pageAddr=base; pageAddr!=base+size; pageAddr+=pageSize)
+        {
+            auto &info = m_pages[pageAddr];
+            info.flags    |= mmio;
+            info.mmioIndex = idx;
+        }
+    }
+
+    //! Флаг вида обращения по запрошенным правам
+    static
+    uint32_t getAccessWatchFlag(MemoryAccessRights requestedMode)
+    {
+        if ((requestedMode&MemoryAccessRights::write)!=0)
+            return watchWrite;
+        if (requestedMode==MemoryAccessRights::execute)
+            return watchExecute;
+        return watchRead;
+    }
+
+    //! Диапазон [addr, addr+size) не должен заворачиваться через конец адресного пространства (проверяет вызывающий)
+    void addWatchpoint(uint64_t addr, uint64_t size, MemoryAccessRights kind)
+    {
+        MARTY_MEM_ASSERT(size!=0 && addr+(size-1u)>=addr);
+        m_watchpoints.emplace_back(Watchpoint{addr, size, kind});
+        updateWatchFlags(addr, size);
+    }
+
+    //! Удаляет точки наблюдения с заданными параметрами. Возвращает false, если таких нет
+    bool removeWatchpoint(uint64_t addr, uint64_t size, MemoryAccessRights kind)
+    {
+        auto it = std::remove_if( m_watchpoints.begin(), m_watchpoints.end()
+                                , [&](const Watchpoint &wp) { return wp.addr==addr && wp.size==size && wp.kind==kind; }
+                                );
+        if (it==m_watchpoints.end())
+            return false;
+
+        m_watchpoints.erase(it, m_watchpoints.end());
+        updateWatchFlags(addr, size);
+        return true;
+    }
+
+    void clearWatchpoints()
+    {
+        auto watchpoints = std::move(m_watchpoints);
+        m_watchpoints.clear();
+        for(const auto &wp : watchpoints)
+            updateWatchFlags(wp.addr, wp.size);
+    }
+
+    const std::vector<Watchpoint>& getWatchpoints() const { return m_watchpoints; }
+
+    void setWatchpointHandler(WatchpointHandler handler) { m_watchpointHandler = std::move(handler); }
+
+    const std::vector<WatchpointHit>& getWatchpointHits() const { return m_watchpointHits; }
+    void clearWatchpointHits() { m_watchpointHits.clear(); }
+
+    //! Проверяет обращение [addr, addr+size) вида watchFlag по списку точек наблюдения. Вызывается только для помеченных страниц
+    void checkWatchpoints(uint64_t addr, uint64_t size, uint32_t watchFlag) const
+    {
+        for(const auto &wp : m_watchpoints)
+        {
+            if ((getWatchFlags(wp.kind)&watchFlag)==0 || !wp.intersects(addr, size))
+                continue;
+
+            WatchpointHit hit;
+            hit.addr      = addr;
+            hit.size      = size;
+            hit.kind      = watchFlag==watchWrite ? MemoryAccessRights::write : watchFlag==watchExecute ? MemoryAccessRights::execute : MemoryAccessRights::read;
+            hit.watchAddr = wp.addr;
+
+            if (m_watchpointHandler)
+                m_watchpointHandler(hit);
+            else
+                m_watchpointHits.push_back(hit);
+        }
+    }
+
+    //! Помечает страницы диапазона [addr, addr+size) как страницы кода
+    void markCodePages(uint64_t addr, uint64_t size)
+    {
+        MARTY_MEM_ASSERT(size!=0 && addr+(size-1u)>=addr);
+        forEachPage(addr, size, [&](uint64_t pageAddr) { m_pages[pageAddr].flags |= code; });
+    }
+
+    void unmarkCodePages(uint64_t addr, uint64_t size)
+    {
+        MARTY_MEM_ASSERT(size!=0 && addr+(size-1u)>=addr);
+        forEachPage(addr, size, [&](uint64_t pageAddr)
+        {
+            auto it = m_pages.find(pageAddr);
+            if (it==m_pages.end())
+                return;
+
+            it->second.flags &= ~code;
+            if (!it->second.flags)
+                m_pages.erase(it);
+        });
+    }
+
+    bool isCodePage(uint64_t pageAddr) const
+    {
+        uint32_t idx = 0;
+        return (findPageFlags(pageAddr, &idx)&code)!=0;
+    }
+
+    void setCodePageWriteHandler(CodePageWriteHandler handler) { m_codePageWriteHandler = std::move(handler); }
+
+    //! Снимает отметку со страницы кода и вызывает обработчик
+    void onCodePageWrite(uint64_t pageAddr)
+    {
+        unmarkCodePages(pageAddr, 1u);
+        if (m_codePageWriteHandler)
+            m_codePageWriteHandler(pageAddr);
+    }
+
+    //! Удаляет все диапазоны MMIO
+    void clearMmio()
+    {
+        for(auto it=m_pages.begin(); it!=m_pages.end(); )
+        {
+            it->second.flags &= ~mmio;
+            it->second.mmioIndex = 0;
+            if (!it->second.flags)
+                it = m_pages.erase(it);
+            else
+                ++it;
+        }
+
+        m_mmioRanges.clear();
+    }
+
+}; // class MemoryPageHooks
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/page_hooks.h"
+
@@ -0,0 +1,121 @@
+/*! \file
+    \brief Упорядоченный индекс адресов страниц - для запросов по диапазонам адресов
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Страницы хранятся в unordered_map (или radix-таблице), по которой нельзя быстро
+    ответить, какие страницы есть в диапазоне [a, b). Индекс хранит адреса страниц
+    в отсортированном векторе, запрос - двоичный поиск, O(log n + k).
+
+    Добавление дешёвое - адрес дописывается в буфер новых ключей, который сливается
+    с основным вектором при первом запросе (сортировка буфера + inplace_merge).
+    Удаляются страницы редко (перенос в плоский регион, очистка), поэтому удаление
+    сразу правит вектор.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/page_index.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+class SortedPageIndex
+{
+
+protected:
+
+    mutable std::vector<uint64_t>    m_keys;    // Отсортированы
+    mutable std::vector<uint64_t>    m_pending; // Добавлены после последнего слияния, не отсортированы
+
+
+    void mergePending() const
+    {
+        if (m_pending.empty())
+            return;
+
+        std::sort(m_pending.begin(), m_pending.end());
+
+        auto mid = m_keys.size();
+        m_keys.insert(m_keys.end(), m_pending.begin(), m_pending.end());
+        std::inplace_merge(m_keys.begin(), m_keys.begin()+std::ptrdiff_t(mid), m_keys.end());
+
+        m_pending.clear();
+    }
+
+
+public:
+
+    bool        empty() const { return m_keys.empty() && m_pending.empty(); }
+    std::size_t size()  const { return m_keys.size() + m_pending.size(); }
+
+    void clear()
+    {
+        m_keys.clear();
+        m_pending.clear();
+    }
+
+    void swap(SortedPageIndex &other)
+    {
+        m_keys.swap(other.m_keys);
+        m_pending.swap(other.m_pending);
+    }
+
+    //! Ключа в индексе быть не должно - его отсутствие гарантирует хранилище страниц
+    void insert(uint64_t key)
+    {
+        m_pending.push_back(key);
+    }
+
+    //! Удаляет ключи из [first, last]
+    void eraseRange(uint64_t first, uint64_t last)
+    {
+        MARTY_MEM_ASSERT(first<=last);
+
+        mergePending();
+
+        auto itFirst = std::lower_bound(m_keys.begin(), m_keys.end(), first);
+        auto itLast  = std::upper_bound(itFirst, m_keys.end(), last);
+        m_keys.erase(itFirst, itLast);
+    }
+
+    //! Отсортированные ключи. Ссылка действительна до следующего изменения индекса
+    const std::vector<uint64_t>& getKeys() const
+    {
+        mergePending();
+        return m_keys;
+    }
+
+}; // class SortedPageIndex
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/page_index.h"
+
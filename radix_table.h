@@ -0,0 +1,234 @@
+/*! \file
+    \brief Многоуровневая radix-таблица (в стиле page table процессора)
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Ключ (индекс параграфа/страницы) разбивается на группы по LevelBits бит,
+    каждая группа - индекс в узле соответствующего уровня. Узлы создаются
+    лениво, при первой вставке. Поиск - это несколько сдвигов и загрузок,
+    без хэширования.
+
+    Таблица хранит только указатели на значения и не владеет ими -
+    временем жизни значений управляет владелец таблицы.
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <cstddef>
+#include <utility>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/radix_table.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+template<typename ValueType, int KeyBits, int LevelBits=10>
+class RadixTable
+{
+
+public:
+
+    static constexpr const int         keyBits    = KeyBits;
+    static constexpr const int         levelBits  = LevelBits;
+    static constexpr const int         numLevels  = (KeyBits+LevelBits-1)/LevelBits;
+    static constexpr const std::size_t nodeSize   = std::size_t(1)<<LevelBits;
+    static constexpr const uint64_t    levelMask  = uint64_t(nodeSize-1u);
+
+    static_assert(KeyBits>0 && KeyBits<=64, "RadixTable: invalid KeyBits");
+    static_assert(LevelBits>0 && LevelBits<=16, "RadixTable: invalid LevelBits");
+
+
+protected:
+
+    // На нижнем уровне в слотах лежат ValueType*, на остальных - Node*
+    struct Node
+    {
+        void*   slots[nodeSize];
+    };
+
+    Node          *m_pRoot = 0;
+    std::size_t    m_size  = 0;
+
+
+    static
+    std::size_t levelIndex(uint64_t key, int level) // level 0 - верхний уровень
+    {
+        return std::size_t((key>>(LevelBits*(numLevels-1-level)))&levelMask);
+    }
+
+    static
+    void freeNode(Node *pNode, int level)
+    {
+        if (!pNode)
+            return;
+
+        if (level!=numLevels-1)
+        {
+            for(std::size_t i=0u; i!=nodeSize; ++i)
+                freeNode(static_cast<Node*>(pNode->slots[i]), level+1);
+        }
+
+        delete pNode;
+    }
+
+    template<typename Handler>
+    static
+    void forEachImpl(const Node *pNode, int level, uint64_t keyPrefix, Handler &h)
+    {
+        for(std::size_t i=0u; i!=nodeSize; ++i)
+        {
+            if (!pNode->slots[i])
+                continue;
+
+            uint64_t key = (keyPrefix<<LevelBits) | uint64_t(i);
+
+            if (level==numLevels-1)
+                h(key, static_cast<ValueType*>(pNode->slots[i]));
+            else
+                forEachImpl(static_cast<const Node*>(pNode->slots[i]), level+1, key, h);
+        }
+    }
+
+
+public:
+
+    RadixTable() {}
+
+    ~RadixTable()
+    {
+        clear();
+    }
+
+    RadixTable(const RadixTable &) = delete;
+    RadixTable& operator=(const RadixTable &) = delete;
+
+    RadixTable(RadixTable &&other)
+    : m_pRoot(std::exchange(other.m_pRoot, (Node*)0))
+    , m_size (std::exchange(other.m_size , std::size_t(0)))
+    {}
+
+    RadixTable& operator=(RadixTable &&other)
+    {
+        if (&other==this)
+            return *this;
+
+        clear();
+        m_pRoot = std::exchange(other.m_pRoot, (Node*)0);
+        m_size  = std::exchange(other.m_size , std::size_t(0));
+        return *this;
+    }
+
+    void swap(RadixTable &other)
+    {
+        std::swap(m_pRoot, other.m_pRoot);
+        std::swap(m_size , other.m_size );
+    }
+
+    bool        empty() const { return m_size==0; }
+    std::size_t size()  const { return m_size; }
+
+    //! Освобождает узлы таблицы. Сами значения не удаляются
+    void clear()
+    {
+        freeNode(m_pRoot, 0);
+        m_pRoot = 0;
+        m_size  = 0;
+    }
+
+    ValueType* find(uint64_t key) const
+    {
+        const Node *pNode = m_pRoot;
+        for(int level=0; pNode && level!=numLevels-1; ++level)
+            pNode = static_cast<const Node*>(pNode->slots[levelIndex(key, level)]);
+
+        if (!pNode)
+            return 0;
+
+        return static_cast<ValueType*>(pNode->slots[levelIndex(key, numLevels-1)]);
+    }
+
+    //! Вставляет значение, если по ключу ничего нет. Возвращает значение, лежащее в таблице после вставки
+    ValueType* insert(uint64_t key, ValueType *pVal)
+    {
+        MARTY_MEM_ASSERT(pVal);
+
+        if (!m_pRoot)
+            m_pRoot = new Node();
+
+        Node *pNode = m_pRoot;
+        for(int level=0; level!=numLevels-1; ++level)
+        {
+            void *&slot = pNode->slots[levelIndex(key, level)];
+            if (!slot)
+                slot = new Node();
+            pNode = static_cast<Node*>(slot);
+        }
+
+        void *&leafSlot = pNode->slots[levelIndex(key, numLevels-1)];
+        if (!leafSlot)
+        {
+            leafSlot = pVal;
+            ++m_size;
+        }
+
+        return static_cast<ValueType*>(leafSlot);
+    }
+
+    //! Удаляет значение из таблицы и возвращает его (или 0, если по ключу ничего нет). Опустевшие узлы не освобождаются
+    ValueType* erase(uint64_t key)
+    {
+        Node *pNode = m_pRoot;
+        for(int level=0; pNode && level!=numLevels-1; ++level)
+            pNode = static_cast<Node*>(pNode->slots[levelIndex(key, level)]);
+
+        if (!pNode)
+            return 0;
+
+        void *&leafSlot = pNode->slots[levelIndex(key, numLevels-1)];
+        auto pVal = static_cast<ValueType*>(leafSlot);
+        if (pVal)
+        {
+            leafSlot = 0;
+            --m_size;
+        }
+
+        return pVal;
+    }
+
+    //! Обход в порядке возрастания ключей. Handler - void(uint64_t key, ValueType *pVal)
+    template<typename Handler>
+    void forEach(Handler h) const
+    {
+        if (m_pRoot)
+            forEachImpl(m_pRoot, 0, 0, h);
+    }
+
+}; // class RadixTable
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/radix_table.h"
+
@@ -0,0 +1,320 @@
+/*! \file
+    \brief Таблица регионов памяти - права доступа и значения по умолчанию
+ */
+
+#pragma once
+
+//----------------------------------------------------------------------------
+/*
+    Регионы - непересекающиеся интервалы адресов, отсортированные по началу.
+    Для каждого региона задаются права доступа и байт по умолчанию
+    (обычно 0x00 для ОЗУ и 0xFF для флешки). Добавление региона поверх
+    существующих вырезает из них пересекающуюся часть.
+
+    Поиск региона по адресу:
+      - кеш последнего попадания - в типичном случае одно сравнение;
+      - карта страниц - для каждой страницы индекс региона, целиком её
+        покрывающего (если регионов на странице несколько - особая отметка);
+        строится, если покрытый регионами диапазон не слишком велик;
+      - иначе - двоичный поиск.
+
+    Адреса вне регионов получают права unmappedAccessRights (по умолчанию
+    всё разрешено, чтобы пустая таблица ничего не меняла) и значение по
+    умолчанию из MemoryOptionFlags.
+
+    Права проверяются так: доступ разрешён, если в правах региона есть хотя бы
+    один из запрошенных битов (чтение по умолчанию запрашивается как executeRead,
+    и его должен пропускать как регион только для чтения, так и только для исполнения).
+*/
+
+//----------------------------------------------------------------------------
+#include "assert.h"
+#include "enums.h"
+#include "fixed_size_types.h"
+
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// #include "marty_mem/region_table.h"
+// marty::mem::
+namespace marty{
+namespace mem{
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+struct MemoryRegionInfo
+{
+    uint64_t              base        = 0;
+    uint64_t              size        = 0;
+    MemoryAccessRights    rights      = MemoryAccessRights::executeReadWrite;
+    byte_t                defaultByte = 0;
+
+    bool contains(uint64_t addr) const
+    {
+        return addr-base < size;
+    }
+
+    uint64_t end() const
+    {
+        return base+size;
+    }
+
+}; // struct MemoryRegionInfo
+
+//----------------------------------------------------------------------------
+template<int PageBits, std::size_t MaxPageMapSize=std::size_t(1)<<20>
+class MemoryRegionTable
+{
+
+public:
+
+    static constexpr const uint64_t    pageSize       = uint64_t(1)<<PageBits;
+    static constexpr const uint64_t    pageMask       = pageSize-1u;
+    static constexpr const std::size_t maxPageMapSize = MaxPageMapSize;
+
+
+protected:
+
+    static constexpr const uint32_t    noRegion       = 0u;
+    static constexpr const uint32_t    mixedPage      = uint32_t(-1);
+
+    std::vector<MemoryRegionInfo>    m_regions;
+    std::vector<uint32_t>            m_pageMap;          // Индекс региона + 1, noRegion или mixedPage
+    uint64_t                         m_pageMapBase = 0;
+    mutable std::size_t              m_lastHit     = 0;
+    MemoryAccessRights               m_unmappedAccessRights = MemoryAccessRights::executeReadWrite;
+
+
+    // requestedMode - набор допустимых вариантов доступа, достаточно любого из них: чтение запрашивается
+    // как executeRead (выборка кода или данных). Поэтому запись должна запрашиваться только как write -
+    // с executeRead регион только для чтения запись пропустит
+    static
+    bool checkRights(MemoryAccessRights rights, MemoryAccessRights requestedMode)
+    {
+        return requestedMode==MemoryAccessRights::noAccess || (rights&requestedMode)!=0;
+    }
+
+    // Индекс первого региона, начинающегося после addr
+    std::size_t findNextIndex(uint64_t addr) const
+    {
+        auto it = std::upper_bound(m_regions.begin(), m_regions.end(), addr, [](uint64_t a, const MemoryRegionInfo &r) { return a<r.base; });
+        return std::size_t(it-m_regions.begin());
+    }
+
+    void rebuildPageMap()
+    {
+        m_pageMap.clear();
+        m_lastHit = 0;
+
+        if (m_regions.empty())
+            return;
+
+        uint64_t first = m_regions.front().base & ~pageMask;
+        uint64_t last  = (m_regions.back().end()-1u) & ~pageMask;
+        uint64_t numPages = ((last-first)>>PageBits)+1u;
+
+        if (numPages>uint64_t(MaxPageMapSize))
+            return; // Слишком большой разброс - обходимся двоичным поиском
+
+        m_pageMapBase = first;
+        m_pageMap.assign(std::size_t(numPages), noRegion);
+
+        for(std::size_t i=0; i!=m_regions.size(); ++i)
+        {
+            const auto &r = m_regions[i];
+            uint64_t lastByte = r.end()-1u;
+
+            for(uint64_t pageAddr=r.base&~pageMask; ; pageAddr+=pageSize)
+            {
+                uint32_t &v = m_pageMap[std::size_t((pageAddr-m_pageMapBase)>>PageBits)];
+                bool bFull  = pageAddr>=r.base && pageAddr+pageMask<=lastByte;
+                v = (bFull && v==noRegion) ? uint32_t(i+1u) : mixedPage;
+
+                if (pageAddr==(lastByte&~pageMask))
+                    break;
+            }
+        }
+    }
+
+
+public:
+
+    bool empty() const { return m_regions.empty(); }
+
+    const std::vector<MemoryRegionInfo>& getRegions() const { return m_regions; }
+
+    MemoryAccessRights getUnmappedAccessRights() const { return m_unmappedAccessRights; }
+    void setUnmappedAccessRights(MemoryAccessRights rights) { m_unmappedAccessRights = rights; }
+
+    void clear()
+    {
+        m_regions.clear();
+        rebuildPageMap();
+    }
+
+    //! Добавляет регион. Части ранее добавленных регионов, попавшие в [base, base+size), заменяются
+    void addRegion(uint64_t base, uint64_t size, MemoryAccessRights rights, byte_t defaultByte)
+    {
+        MARTY_MEM_ASSERT(size!=0 && base+size>base); // Регион не должен заворачиваться через конец адресного пространства
+        if (!size)
+            return;
+
+        MemoryRegionInfo newRegion;
+        newRegion.base        = base;
+        newRegion.size        = size;
+        newRegion.rights      = rights;
+        newRegion.defaultByte = defaultByte;
+
+        std::vector<MemoryRegionInfo> regions;
+        regions.reserve(m_regions.size()+2u);
+
+        for(const auto &r : m_regions)
+        {
+            if (r.end()<=base || newRegion.end()<=r.base)
+            {
+                regions.push_back(r);
+                continue;
+            }
+
+            if (r.base<base) // Хвост слева
+            {
+                auto left = r;
+                left.size = base-r.base;
+                regions.push_back(left);
+            }
+
+            if (newRegion.end()<r.end()) // Хвост справа
+            {
+                auto right = r;
+                right.base = newRegion.end();
+                right.size = r.end()-newRegion.end();
+                regions.push_back(right);
+            }
+        }
+
+        regions.push_back(newRegion);
+        std::sort(regions.begin(), regions.end(), [](const MemoryRegionInfo &a, const MemoryRegionInfo &b) { return a.base<b.base; });
+
+        m_regions.swap(regions);
+        rebuildPageMap();
+    }
+
+    //! Регион, содержащий адрес, или 0
+    const MemoryRegionInfo* findRegion(uint64_t addr) const
+    {
+        if (m_lastHit<m_regions.size() && m_regions[m_lastHit].contains(addr))
+            return &m_regions[m_lastHit];
+
+        if (m_regions.empty())
+            return 0;
+
+        uint64_t pageIdx = (addr-m_pageMapBase)>>PageBits;
+        if (pageIdx<uint64_t(m_pageMap.size()))
+        {
+            uint32_t v = m_pageMap[std::size_t(pageIdx)];
+            if (v==noRegion)
+                return 0;
+
+            if (v!=mixedPage)
+            {
+                m_lastHit = std::size_t(v-1u);
+                return &m_regions[m_lastHit];
+            }
+        }
+
+        auto idx = findNextIndex(addr);
+        if (idx==0 || !m_regions[idx-1u].contains(addr))
+            return 0;
+
+        m_lastHit = idx-1u;
+        return &m_regions[m_lastHit];
+    }
+
+    //! Длина (не больше n) участка от addr, который целиком лежит в одном регионе или целиком вне регионов
+    uint64_t calcSpanSize(uint64_t addr, uint64_t n) const
+    {
+        if (m_regions.empty())
+            return n;
+
+        if (auto pRegion = findRegion(addr))
+            return std::min(n, pRegion->end()-addr);
+
+        auto idx = findNextIndex(addr);
+        if (idx==m_regions.size())
+            return n;
+
+        return std::min(n, m_regions[idx].base-addr);
+    }
+
+    MemoryAccessResultCode checkAccessRights(uint64_t addr, uint64_t size, MemoryAccessRights requestedMode) const
+    {
+        if (m_regions.empty())
+            return checkRights(m_unmappedAccessRights, requestedMode) ? MemoryAccessResultCode::accessGranted : MemoryAccessResultCode::accessDenied;
+
+        while(size)
+        {
+            auto pRegion = findRegion(addr);
+            auto rights  = pRegion ? pRegion->rights : m_unmappedAccessRights;
+
+            if (!checkRights(rights, requestedMode))
+                return MemoryAccessResultCode::accessDenied;
+
+            if (pRegion && size<=pRegion->end()-addr) // Типичный случай - весь доступ внутри одного региона
+                break;
+
+            auto spanSize = calcSpanSize(addr, size);
+            addr += spanSize;
+            size -= spanSize;
+        }
+
+        return MemoryAccessResultCode::accessGranted;
+    }
+
+    //! Значение по умолчанию (байты по порядку адресов, от младшего). Байты вне регионов - unmappedByte
+    uint64_t getDefaultValue(uint64_t addr, uint64_t size, byte_t unmappedByte) const
+    {
+        MARTY_MEM_ASSERT(size>=1u && size<=8u);
+
+        const uint64_t byteOnes = ~uint64_t(0)/0xFFu >> (64u-8u*unsigned(size)); // 0x01 в каждом из size байт
+
+        auto pRegion = findRegion(addr);
+        if (pRegion && size<=pRegion->end()-addr)
+            return uint64_t(pRegion->defaultByte)*byteOnes;
+
+        if (calcSpanSize(addr, size)==size) // Целиком вне регионов
+            return uint64_t(unmappedByte)*byteOnes;
+
+        // Значение пересекает границу региона - собираем побайтно
+        uint64_t val = 0;
+        for(uint64_t i=size; i!=0u; --i)
+        {
+            auto pR = findRegion(addr+i-1u);
+            val = (val<<8) | uint64_t(pR ? pR->defaultByte : unmappedByte);
+        }
+
+        return val;
+    }
+
+}; // class MemoryRegionTable
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+
+} // namespace mem
+} // namespace marty
+// marty::mem::
+// #include "marty_mem/region_table.h"
+
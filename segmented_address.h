@@ -185,10 +185,9 @@ public:
             throw invalid_address_difference(msg);
     }
 
-    // "Расстояние" от текущего до pv - сколько надо прибавить к текущему, чтобы получить pv => *pv > *this => dist = pv - dist
-    virtual ptrdiff_t distanceTo(const VirtualAddress *pv) const override
+    // "Расстояние" от текущего до other - сколько надо прибавить к текущему, чтобы получить other. Без виртуальных вызовов и dynamic_cast
+    ptrdiff_t distanceTo(const SegmentedAddress &other) const
     {
-        const SegmentedAddress &other = dynamic_cast<const SegmentedAddress&>(*pv); // Чтобы самим не кидать исключение bad_cast, используем ссылки
         checkCompat(other);
         auto diff = other.m_offset - m_offset;
         diff &= m_offsetMask;
@@ -196,9 +195,8 @@ public:
         return ptrdiff_t(diff) / ptrdiff_t(m_incSize);
     }
 
-    virtual bool equalTo(const VirtualAddress *pv) const override
+    bool equalTo(const SegmentedAddress &other) const
     {
-        const SegmentedAddress &other = dynamic_cast<const SegmentedAddress&>(*pv); // Чтобы самим не кидать исключение bad_cast, используем ссылки
         checkCompat(other);
         auto diff = other.m_offset - m_offset;
         diff &= m_offsetMask;
@@ -206,6 +204,21 @@ public:
         return m_segment==other.m_segment && m_offset==other.m_offset;
     }
 
+    // "Расстояние" от текущего до pv - сколько надо прибавить к текущему, чтобы получить pv => *pv > *this => dist = pv - dist
+    virtual ptrdiff_t distanceTo(const VirtualAddress *pv) const override
+    {
+        if (pv->getAddressModel()!=VirtualAddressModel::segmented)
+            throw std::bad_cast();
+        return distanceTo(static_cast<const SegmentedAddress&>(*pv));
+    }
+
+    virtual bool equalTo(const VirtualAddress *pv) const override
+    {
+        if (pv->getAddressModel()!=VirtualAddressModel::segmented)
+            throw std::bad_cast();
+        return equalTo(static_cast<const SegmentedAddress&>(*pv));
+    }
+
     virtual SharedVirtualAddress clone() const override
     {
         auto copyOfThis = std::make_shared<SegmentedAddress>(*this);
@@ -222,10 +235,11 @@ public:
         return bits::countOnes(incSize)==1 && incSize<=8; // Не поддерживается гранулярность обращения к памяти больше 8 байт
     }
 
-    SegmentedAddress() {}
+    SegmentedAddress() : VirtualAddress(VirtualAddressModel::segmented) {}
 
     SegmentedAddress(uint64_t seg, uint64_t offs, uint64_t inc=1, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
-    : m_segment(seg)
+    : VirtualAddress(VirtualAddressModel::segmented)
+    , m_segment(seg)
     , m_offset (offs)
     , m_incSize(inc)
     , m_traits (traits)
@@ -279,6 +293,8 @@ public:
 
 }; // struct SegmentedAddress
 
+static_assert(IsInlineVirtualAddress<SegmentedAddress>::value, "SegmentedAddress must fit into InlineVirtualAddress");
+
 //----------------------------------------------------------------------------
 
 
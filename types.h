@@ -12,6 +12,40 @@
 #include <vector>
 
 //----------------------------------------------------------------------------
+#if !defined(MARTY_MEM_HAS_SPAN)
+
+    #if defined __has_include
+        #if __has_include(<span>)
+            #if (defined(_MSVC_LANG) && _MSVC_LANG>=202002L) || __cplusplus>=202002L
+                #define MARTY_MEM_HAS_SPAN
+            #endif
+        #endif
+    #endif
+
+#endif
+
+#if defined(MARTY_MEM_HAS_SPAN)
+    #include <span>
+#endif
+
+//----------------------------------------------------------------------------
+#if !defined(MARTY_MEM_HAS_PMR)
+
+    #if defined __has_include
+        #if __has_include(<memory_resource>)
+            #if (defined(_MSVC_LANG) && _MSVC_LANG>=201703L) || __cplusplus>=201703L
+                #define MARTY_MEM_HAS_PMR
+            #endif
+        #endif
+    #endif
+
+#endif
+
+#if defined(MARTY_MEM_HAS_PMR)
+    #include <memory_resource>
+#endif
+
+//----------------------------------------------------------------------------
 
 
 
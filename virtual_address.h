@@ -4,8 +4,14 @@
 
 /*
     Если мы такой адрес будем использовать в итераторе, а там всякие инкременты/декременты пре/пост,
-    то нам придётся часто клонировать объекты - наследники VirtualAddress. В этом есть некоторая проблема,
-    но ничего особо не сделать.
+    то нам придётся часто копировать объекты - наследники VirtualAddress. Чтобы копия не стоила
+    выделения памяти и атомарного счётчика shared_ptr, адрес хранится в InlineVirtualAddress -
+    объект размещается во встроенном буфере и копируется по значению. В буфер помещаются LinearAddress
+    и SegmentedAddress, более крупные наследники, как и раньше, хранятся в SharedVirtualAddress
+    и копируются через clone().
+
+    Модель адреса (VirtualAddressModel) хранится в базовом классе и читается без виртуального вызова -
+    distanceTo/equalTo проверяют совпадение моделей по ней, а не через dynamic_cast.
 
 */
 
@@ -17,9 +23,14 @@
 #include "fixed_size_types.h"
 
 //----------------------------------------------------------------------------
+#include <cstddef>
 #include <exception>
 #include <memory>
+#include <new>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 //----------------------------------------------------------------------------
 
@@ -47,10 +58,33 @@ struct AddressInfo
 }; // struct AddressInfo
 
 
+//----------------------------------------------------------------------------
+//! Модель адреса - для быстрой проверки, что два VirtualAddress одного типа
+enum class VirtualAddressModel : std::uint32_t
+{
+    unknown    = 0,
+    linear     = 1,
+    segmented  = 2
+
+}; // enum class VirtualAddressModel
+
+
 //----------------------------------------------------------------------------
 struct VirtualAddress
 {
 
+protected:
+
+    VirtualAddressModel      m_addressModel = VirtualAddressModel::unknown;
+
+    explicit VirtualAddress(VirtualAddressModel m) : m_addressModel(m) {}
+
+public:
+
+    VirtualAddress() {}
+
+    VirtualAddressModel getAddressModel() const { return m_addressModel; }
+
     virtual ~VirtualAddress() {}
     virtual SharedVirtualAddress clone() const = 0;
     virtual void setIncrement(uint64_t) = 0;
@@ -69,6 +103,164 @@ struct VirtualAddress
 }; // struct VirtualAddress
 
 //----------------------------------------------------------------------------
+constexpr const std::size_t inlineVirtualAddressSize  = 96u; // LinearAddress и SegmentedAddress помещаются (см. static_assert в их заголовках)
+constexpr const std::size_t inlineVirtualAddressAlign = alignof(std::max_align_t);
+
+//! Наследник VirtualAddress, который InlineVirtualAddress хранит во встроенном буфере
+template<typename AddressType>
+struct IsInlineVirtualAddress
+{
+    static constexpr const bool value = sizeof(AddressType)<=inlineVirtualAddressSize
+                                     && alignof(AddressType)<=inlineVirtualAddressAlign
+                                     && std::is_nothrow_copy_constructible<AddressType>::value;
+};
+
+//----------------------------------------------------------------------------
+//! Виртуальный адрес со встроенным хранилищем - копируется по значению, без выделения памяти
+class InlineVirtualAddress
+{
+
+protected:
+
+    using copy_fn_t = VirtualAddress* (*)(void *pBuf, const VirtualAddress *pSrc);
+
+    template<typename AddressType>
+    static VirtualAddress* copyInline(void *pBuf, const VirtualAddress *pSrc)
+    {
+        return ::new(pBuf) AddressType(*static_cast<const AddressType*>(pSrc));
+    }
+
+    alignas(inlineVirtualAddressAlign) unsigned char  m_buf[inlineVirtualAddressSize];
+    VirtualAddress                     *m_pAddress = 0; // Указывает в m_buf или на объект m_shared
+    copy_fn_t                           m_pCopy    = 0; // Не нулевой - адрес лежит в m_buf
+    SharedVirtualAddress                m_shared;       // Адрес, не поместившийся в буфер
+
+
+    void reset()
+    {
+        if (m_pCopy)
+            m_pAddress->~VirtualAddress();
+        m_pAddress = 0;
+        m_pCopy    = 0;
+        m_shared.reset();
+    }
+
+    void assignFrom(const InlineVirtualAddress &other)
+    {
+        if (other.m_pCopy)
+        {
+            m_pAddress = other.m_pCopy(&m_buf[0], other.m_pAddress);
+            m_pCopy    = other.m_pCopy;
+        }
+        else if (other.m_pAddress)
+        {
+            m_shared   = other.m_pAddress->clone();
+            m_pAddress = m_shared.get();
+        }
+    }
+
+    void moveFrom(InlineVirtualAddress &other)
+    {
+        if (other.m_pCopy)
+        {
+            assignFrom(other); // Встроенные адреса копировать дёшево
+        }
+        else
+        {
+            m_shared   = std::move(other.m_shared);
+            m_pAddress = m_shared.get();
+            other.m_pAddress = 0;
+        }
+    }
+
+
+public:
+
+    InlineVirtualAddress() {}
+
+    template< typename AddressType
+            , typename std::enable_if< std::is_base_of<VirtualAddress, AddressType>::value && IsInlineVirtualAddress<AddressType>::value, int>::type = 0
+            >
+    InlineVirtualAddress(const AddressType &a)
+    : m_pAddress(::new(&m_buf[0]) AddressType(a))
+    , m_pCopy(&copyInline<AddressType>)
+    {}
+
+    template< typename AddressType
+            , typename std::enable_if< std::is_base_of<VirtualAddress, AddressType>::value && !IsInlineVirtualAddress<AddressType>::value, int>::type = 0
+            >
+    InlineVirtualAddress(const AddressType &a)
+    : m_shared(a.clone())
+    {
+        m_pAddress = m_shared.get();
+    }
+
+    //! Совместимость - адрес, созданный через clone(). Владение не разделяется, копии делаются через clone()
+    InlineVirtualAddress(SharedVirtualAddress pva) : m_shared(std::move(pva))
+    {
+        m_pAddress = m_shared.get();
+    }
+
+    InlineVirtualAddress(const InlineVirtualAddress &other)
+    {
+        assignFrom(other);
+    }
+
+    InlineVirtualAddress(InlineVirtualAddress &&other)
+    {
+        moveFrom(other);
+    }
+
+    InlineVirtualAddress& operator=(const InlineVirtualAddress &other)
+    {
+        if (&other!=this)
+        {
+            reset();
+            assignFrom(other);
+        }
+        return *this;
+    }
+
+    InlineVirtualAddress& operator=(InlineVirtualAddress &&other)
+    {
+        if (&other!=this)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ~InlineVirtualAddress()
+    {
+        reset();
+    }
+
+    explicit operator bool() const { return m_pAddress!=0; }
+
+    bool isInline() const { return m_pCopy!=0; }
+
+    VirtualAddressModel getAddressModel() const
+    {
+        return m_pAddress ? m_pAddress->getAddressModel() : VirtualAddressModel::unknown;
+    }
+
+    VirtualAddress*       get()              { return m_pAddress; }
+    const VirtualAddress* get()        const { return m_pAddress; }
+    VirtualAddress*       operator->()       { MARTY_MEM_ASSERT(m_pAddress); return m_pAddress; }
+    const VirtualAddress* operator->() const { MARTY_MEM_ASSERT(m_pAddress); return m_pAddress; }
+    VirtualAddress&       operator*()        { MARTY_MEM_ASSERT(m_pAddress); return *m_pAddress; }
+    const VirtualAddress& operator*()  const { MARTY_MEM_ASSERT(m_pAddress); return *m_pAddress; }
+
+    //! Отдельная копия в shared_ptr - для кода, который работает с SharedVirtualAddress
+    SharedVirtualAddress clone() const
+    {
+        return m_pAddress ? m_pAddress->clone() : SharedVirtualAddress();
+    }
+
+}; // class InlineVirtualAddress
+
+//----------------------------------------------------------------------------
 
 
 
@@ -3,9 +3,12 @@
  */
 
 /*
-    Если мы такой адрес будем использовать в итераторе, а там всякие инкременты/декременты пре/пост,
-    то нам придётся часто клонировать объекты - наследники VirtualAddress. В этом есть некоторая проблема,
-    но ничего особо не сделать.
+    Итератор хранит адрес в InlineVirtualAddress - копия итератора (пост-инкремент, operator+ и тп)
+    копирует адрес во встроенный буфер, без выделения памяти. Копия всегда независима от оригинала,
+    deepCopy() оставлен для совместимости.
+
+    Если модель адреса известна при компиляции, лучше использовать AddressMemoryIterator
+    (address_memory_iterator.h) - там и виртуальных вызовов нет.
 
 */
 
@@ -26,6 +29,7 @@
 #include <exception>
 #include <memory>
 #include <stdexcept>
+#include <utility>
 
 //----------------------------------------------------------------------------
 
@@ -42,25 +46,25 @@ namespace mem{
 
 
 //----------------------------------------------------------------------------
-template<typename IntType>
+template<typename IntType, typename MemoryType=Memory>
 struct VirtualAddressMemoryIterator
 {
 
-    Memory                 *pMemory = 0;
+    MemoryType             *pMemory = 0;
     MemoryOptionFlags       memoryOptionFlags = MemoryOptionFlags::none;
-    SharedVirtualAddress    virtualAddress;
+    InlineVirtualAddress    virtualAddress;
     bool                    lastModificationWrapSign = false; // Признак переполнения при последней операции изменения итератора
 
 
     struct AccessProxy
     {
-        Memory             *pMemory = 0;
+        MemoryType         *pMemory = 0;
         uint64_t            address = 0;
         MemoryOptionFlags   memoryOptionFlags = 0;
 
         AccessProxy() {}
 
-        explicit AccessProxy(Memory *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        explicit AccessProxy(MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
         {
             MARTY_MEM_ASSERT(pMemory);
         }
@@ -85,7 +89,7 @@ struct VirtualAddressMemoryIterator
 
     VirtualAddressMemoryIterator() {}
 
-    explicit VirtualAddressMemoryIterator(Memory *pm, SharedVirtualAddress va, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), virtualAddress(va)
+    explicit VirtualAddressMemoryIterator(MemoryType *pm, InlineVirtualAddress va, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), virtualAddress(std::move(va))
     {
         // MARTY_MEM_ASSERT(pMemory); // Можно создавать итераторы с нулевым указателем на память, но нельзя по ним обращаться к памяти
 
@@ -104,17 +108,16 @@ struct VirtualAddressMemoryIterator
         return virtualAddress->getAddressInfo();
     }
 
+    // Копия итератора и так независима от оригинала
     VirtualAddressMemoryIterator deepCopy() const
     {
-        auto cp = *this;
-        cp.virtualAddress = virtualAddress->clone();
-        return cp;
+        return *this;
     }
 
     template<typename OtherType>
-    explicit VirtualAddressMemoryIterator(const VirtualAddressMemoryIterator<OtherType> &other ) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
+    explicit VirtualAddressMemoryIterator(const VirtualAddressMemoryIterator<OtherType, MemoryType> &other ) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
     {
-        virtualAddress = other.virtualAddress.deepCopy();
+        virtualAddress = other.virtualAddress;
         virtualAddress->setIncrement(sizeof(IntType));
     }
 
@@ -140,9 +143,9 @@ struct VirtualAddressMemoryIterator
     void subtract(ptrdiff_t d)  { lastModificationWrapSign=virtualAddress->subtract(d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
 
     VirtualAddressMemoryIterator& operator++()    /* pre  */  { inc(); return *this; }
-    VirtualAddressMemoryIterator  operator++(int) /* post */  { auto cp = deepCopy(); inc(); return cp; }
+    VirtualAddressMemoryIterator  operator++(int) /* post */  { auto cp = *this; inc(); return cp; }
     VirtualAddressMemoryIterator& operator--()    /* pre  */  { dec(); return *this; }
-    VirtualAddressMemoryIterator  operator--(int) /* post */  { auto cp = deepCopy(); dec(); return cp; }
+    VirtualAddressMemoryIterator  operator--(int) /* post */  { auto cp = *this; dec(); return cp; }
     VirtualAddressMemoryIterator& operator+=(ptrdiff_t d)     { add(d); return *this; }
     VirtualAddressMemoryIterator& operator-=(ptrdiff_t d)     { subtract(d); return *this; }
 
@@ -156,21 +159,21 @@ struct VirtualAddressMemoryIterator
 }; // struct VirtualAddressMemoryIterator
 
 
-template<typename IntType> VirtualAddressMemoryIterator<IntType> operator+(const VirtualAddressMemoryIterator<IntType> &it, ptrdiff_t d) { auto cp = it.deepCopy(); cp += d; return cp; }
-template<typename IntType> VirtualAddressMemoryIterator<IntType> operator+(ptrdiff_t d, const VirtualAddressMemoryIterator<IntType> &it) { auto cp = it.deepCopy(); cp += d; return cp; }
-template<typename IntType> VirtualAddressMemoryIterator<IntType> operator-(const VirtualAddressMemoryIterator<IntType> &it, ptrdiff_t d) { auto cp = it.deepCopy(); cp -= d; return cp; }
+template<typename IntType, typename MemoryType> VirtualAddressMemoryIterator<IntType, MemoryType> operator+(const VirtualAddressMemoryIterator<IntType, MemoryType> &it, ptrdiff_t d) { auto cp = it; cp += d; return cp; }
+template<typename IntType, typename MemoryType> VirtualAddressMemoryIterator<IntType, MemoryType> operator+(ptrdiff_t d, const VirtualAddressMemoryIterator<IntType, MemoryType> &it) { auto cp = it; cp += d; return cp; }
+template<typename IntType, typename MemoryType> VirtualAddressMemoryIterator<IntType, MemoryType> operator-(const VirtualAddressMemoryIterator<IntType, MemoryType> &it, ptrdiff_t d) { auto cp = it; cp -= d; return cp; }
 
-template<typename IntType> ptrdiff_t operator-(const VirtualAddressMemoryIterator<IntType> &it1, const VirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> ptrdiff_t operator-(const VirtualAddressMemoryIterator<IntType, MemoryType> &it1, const VirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return it2.virtualAddress->distanceTo(it1.virtualAddress.get());
 }
 
-template<typename IntType> bool operator==(const VirtualAddressMemoryIterator<IntType> &it1, const VirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> bool operator==(const VirtualAddressMemoryIterator<IntType, MemoryType> &it1, const VirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return it1.virtualAddress->equalTo(it2.virtualAddress.get());
 }
 
-template<typename IntType> bool operator!=(const VirtualAddressMemoryIterator<IntType> &it1, const VirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> bool operator!=(const VirtualAddressMemoryIterator<IntType, MemoryType> &it1, const VirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return !it1.virtualAddress->equalTo(it2.virtualAddress.get());
 }
@@ -180,25 +183,25 @@ template<typename IntType> bool operator!=(const VirtualAddressMemoryIterator<In
 
 
 //----------------------------------------------------------------------------
-template<typename IntType>
+template<typename IntType, typename MemoryType=Memory>
 struct ConstVirtualAddressMemoryIterator
 {
 
-    const Memory           *pMemory = 0;
+    const MemoryType       *pMemory = 0;
     MemoryOptionFlags       memoryOptionFlags = MemoryOptionFlags::none;
-    SharedVirtualAddress    virtualAddress;
+    InlineVirtualAddress    virtualAddress;
     bool                    lastModificationWrapSign = false; // Признак переполнения при последней операции изменения итератора
 
 
     struct AccessProxy
     {
-        const Memory       *pMemory = 0;
+        const MemoryType   *pMemory = 0;
         uint64_t            address = 0;
         MemoryOptionFlags   memoryOptionFlags = 0;
 
         AccessProxy() {}
 
-        explicit AccessProxy(const Memory *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
+        explicit AccessProxy(const MemoryType *pm, std::uint64_t addr, MemoryOptionFlags mof) : pMemory(pm), address(addr), memoryOptionFlags(mof)
         {
             MARTY_MEM_ASSERT(pMemory);
         }
@@ -216,7 +219,7 @@ struct ConstVirtualAddressMemoryIterator
 
     ConstVirtualAddressMemoryIterator() {}
 
-    explicit ConstVirtualAddressMemoryIterator(const Memory *pm, SharedVirtualAddress va, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), virtualAddress(va)
+    explicit ConstVirtualAddressMemoryIterator(const MemoryType *pm, InlineVirtualAddress va, MemoryOptionFlags mof=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss) : pMemory(pm), virtualAddress(std::move(va))
     {
         //MARTY_MEM_ASSERT(pMemory);
 
@@ -238,31 +241,32 @@ struct ConstVirtualAddressMemoryIterator
         return virtualAddress->getAddressInfo();
     }
 
+    // Копия итератора и так независима от оригинала
     ConstVirtualAddressMemoryIterator deepCopy() const
     {
-        auto cp = *this;
-        cp.virtualAddress = virtualAddress->clone();
-        return cp;
+        return *this;
     }
 
     template<typename OtherType>
-    explicit ConstVirtualAddressMemoryIterator(const ConstVirtualAddressMemoryIterator<OtherType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
+    explicit ConstVirtualAddressMemoryIterator(const ConstVirtualAddressMemoryIterator<OtherType, MemoryType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
     {
-        virtualAddress = other.virtualAddress.deepCopy();
+        virtualAddress = other.virtualAddress;
         virtualAddress->setIncrement(sizeof(IntType));
     }
 
     template<typename OtherType>
-    explicit ConstVirtualAddressMemoryIterator(const VirtualAddressMemoryIterator<OtherType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
+    explicit ConstVirtualAddressMemoryIterator(const VirtualAddressMemoryIterator<OtherType, MemoryType> &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags)
     {
-        virtualAddress = other.virtualAddress.deepCopy();
+        virtualAddress = other.virtualAddress;
         virtualAddress->setIncrement(sizeof(IntType));
     }
 
-    ConstVirtualAddressMemoryIterator(const ConstVirtualAddressMemoryIterator &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags), virtualAddress(other.virtualAddress)
+    ConstVirtualAddressMemoryIterator(const ConstVirtualAddressMemoryIterator &other) : pMemory(other.pMemory), memoryOptionFlags(other.memoryOptionFlags), virtualAddress(other.virtualAddress), lastModificationWrapSign(other.lastModificationWrapSign)
     {
     }
 
+    ConstVirtualAddressMemoryIterator& operator=(const ConstVirtualAddressMemoryIterator &other) = default;
+
     // Остальные ctor/op= компилятор сам сгенерит
 
     operator std::uint64_t() const    { return virtualAddress->getLinearAddress(); }
@@ -284,9 +288,9 @@ struct ConstVirtualAddressMemoryIterator
     void subtract(ptrdiff_t d)  { lastModificationWrapSign=virtualAddress->subtract(d); if (lastModificationWrapSign && getThrowOnWrapOption()) throwAddressWrap(); }
 
     ConstVirtualAddressMemoryIterator& operator++()    /* pre  */  { inc(); return *this; }
-    ConstVirtualAddressMemoryIterator  operator++(int) /* post */  { auto cp = deepCopy(); inc(); return cp; }
+    ConstVirtualAddressMemoryIterator  operator++(int) /* post */  { auto cp = *this; inc(); return cp; }
     ConstVirtualAddressMemoryIterator& operator--()    /* pre  */  { dec(); return *this; }
-    ConstVirtualAddressMemoryIterator  operator--(int) /* post */  { auto cp = deepCopy(); dec(); return cp; }
+    ConstVirtualAddressMemoryIterator  operator--(int) /* post */  { auto cp = *this; dec(); return cp; }
     ConstVirtualAddressMemoryIterator& operator+=(ptrdiff_t d)     { add(d); return *this; }
     ConstVirtualAddressMemoryIterator& operator-=(ptrdiff_t d)     { subtract(d); return *this; }
 
@@ -300,21 +304,21 @@ struct ConstVirtualAddressMemoryIterator
 }; // struct ConstVirtualAddressMemoryIterator
 
 
-template<typename IntType> ConstVirtualAddressMemoryIterator<IntType> operator+(const ConstVirtualAddressMemoryIterator<IntType> &it, ptrdiff_t d) { auto cp = it.deepCopy(); cp += d; return cp; }
-template<typename IntType> ConstVirtualAddressMemoryIterator<IntType> operator+(ptrdiff_t d, const ConstVirtualAddressMemoryIterator<IntType> &it) { auto cp = it.deepCopy(); cp += d; return cp; }
-template<typename IntType> ConstVirtualAddressMemoryIterator<IntType> operator-(const ConstVirtualAddressMemoryIterator<IntType> &it, ptrdiff_t d) { auto cp = it.deepCopy(); cp -= d; return cp; }
+template<typename IntType, typename MemoryType> ConstVirtualAddressMemoryIterator<IntType, MemoryType> operator+(const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it, ptrdiff_t d) { auto cp = it; cp += d; return cp; }
+template<typename IntType, typename MemoryType> ConstVirtualAddressMemoryIterator<IntType, MemoryType> operator+(ptrdiff_t d, const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it) { auto cp = it; cp += d; return cp; }
+template<typename IntType, typename MemoryType> ConstVirtualAddressMemoryIterator<IntType, MemoryType> operator-(const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it, ptrdiff_t d) { auto cp = it; cp -= d; return cp; }
 
-template<typename IntType> ptrdiff_t operator-(const ConstVirtualAddressMemoryIterator<IntType> &it1, const ConstVirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> ptrdiff_t operator-(const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it1, const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return it2.virtualAddress->distanceTo(it1.virtualAddress.get());
 }
 
-template<typename IntType> bool operator==(const ConstVirtualAddressMemoryIterator<IntType> &it1, const ConstVirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> bool operator==(const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it1, const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return it1.virtualAddress->equalTo(it2.virtualAddress.get());
 }
 
-template<typename IntType> bool operator!=(const ConstVirtualAddressMemoryIterator<IntType> &it1, const ConstVirtualAddressMemoryIterator<IntType> &it2)
+template<typename IntType, typename MemoryType> bool operator!=(const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it1, const ConstVirtualAddressMemoryIterator<IntType, MemoryType> &it2)
 {
     return !it1.virtualAddress->equalTo(it2.virtualAddress.get());
 }
@@ -325,32 +329,32 @@ template<typename IntType> bool operator!=(const ConstVirtualAddressMemoryIterat
 // VirtualAddressMemoryIterator
 // ConstVirtualAddressMemoryIterator
 
-template<typename IntType>
-VirtualAddressMemoryIterator<IntType> makeLinearVirtualAddressMemoryIterator(Memory *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
+template<typename IntType, typename MemoryType>
+VirtualAddressMemoryIterator<IntType, MemoryType> makeLinearVirtualAddressMemoryIterator(MemoryType *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
 {
     auto la = LinearAddress(addr, uint64_t(sizeof(IntType)), traits);
-    return VirtualAddressMemoryIterator<IntType>(pMemory, la.clone(), memoryOptionFlags);
+    return VirtualAddressMemoryIterator<IntType, MemoryType>(pMemory, la, memoryOptionFlags);
 }
 
-template<typename IntType>
-ConstVirtualAddressMemoryIterator<IntType> makeLinearConstVirtualAddressMemoryIterator(const Memory *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
+template<typename IntType, typename MemoryType>
+ConstVirtualAddressMemoryIterator<IntType, MemoryType> makeLinearConstVirtualAddressMemoryIterator(const MemoryType *pMemory, uint64_t addr, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const LinearAddressTraits &traits=LinearAddressTraits{})
 {
     auto la = LinearAddress(addr, uint64_t(sizeof(IntType)), traits);
-    return ConstVirtualAddressMemoryIterator<IntType>(pMemory, la.clone(), memoryOptionFlags);
+    return ConstVirtualAddressMemoryIterator<IntType, MemoryType>(pMemory, la, memoryOptionFlags);
 }
 
-template<typename IntType>
-VirtualAddressMemoryIterator<IntType> makeSegmentedVirtualAddressMemoryIterator(Memory *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
+template<typename IntType, typename MemoryType>
+VirtualAddressMemoryIterator<IntType, MemoryType> makeSegmentedVirtualAddressMemoryIterator(MemoryType *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
 {
     auto sa = SegmentedAddress(seg, offs, uint64_t(sizeof(IntType)), traits);
-    return VirtualAddressMemoryIterator<IntType>(pMemory, sa.clone(), memoryOptionFlags);
+    return VirtualAddressMemoryIterator<IntType, MemoryType>(pMemory, sa, memoryOptionFlags);
 }
 
-template<typename IntType>
-ConstVirtualAddressMemoryIterator<IntType> makeSegmentedConstVirtualAddressMemoryIterator(const Memory *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
+template<typename IntType, typename MemoryType>
+ConstVirtualAddressMemoryIterator<IntType, MemoryType> makeSegmentedConstVirtualAddressMemoryIterator(const MemoryType *pMemory, uint64_t seg, uint64_t offs, MemoryOptionFlags memoryOptionFlags=MemoryOptionFlags::errorOnAddressWrap | MemoryOptionFlags::errorOnHitMiss, const SegmentedAddressTraits &traits=SegmentedAddressTraits{})
 {
     auto sa = SegmentedAddress(seg, offs, uint64_t(sizeof(IntType)), traits);
-    return ConstVirtualAddressMemoryIterator<IntType>(pMemory, sa.clone(), memoryOptionFlags);
+    return ConstVirtualAddressMemoryIterator<IntType, MemoryType>(pMemory, sa, memoryOptionFlags);
 }
 
 